@@ -0,0 +1,209 @@
+#include "culling.h"
+#include <string>
+#include "render_engine.h"
+#include "types.h"
+
+namespace RenderDoos
+  {
+
+#define CULLING_LOCAL_SIZE 64
+
+  static std::string get_culling_shader_header()
+    {
+    return std::string(R"(#version 430 core
+layout (local_size_x = 64) in;
+
+struct draw_indirect_command
+  {
+  uint index_count;
+  uint instance_count;
+  uint first_index;
+  int base_vertex;
+  uint base_instance;
+  };
+
+struct cull_object
+  {
+  vec4 bb_min;
+  vec4 bb_max;
+  draw_indirect_command command;
+  uint padding[3];
+  };
+
+layout (std430, binding = 0) readonly buffer Objects { cull_object objects[]; };
+layout (std430, binding = 1) buffer Commands { draw_indirect_command commands[]; };
+layout (std430, binding = 2) buffer Count { uint count; };
+
+uniform int NumberOfObjects;
+)");
+    }
+
+  static std::string get_culling_clear_shader()
+    {
+    return get_culling_shader_header() + std::string(R"(
+void main()
+  {
+  uint id = gl_GlobalInvocationID.x;
+  if (id == 0)
+    count = 0;
+  if (id < uint(NumberOfObjects))
+    commands[id].instance_count = 0;
+  }
+)");
+    }
+
+  static std::string get_culling_shader()
+    {
+    return get_culling_shader_header() + std::string(R"(
+uniform mat4 ViewProject; // columns
+
+bool is_visible(vec3 bb_min, vec3 bb_max)
+  {
+  vec3 outside_low = vec3(0);
+  vec3 outside_high = vec3(0);
+  for (int i = 0; i < 8; ++i)
+    {
+    vec3 corner = vec3((i & 1) != 0 ? bb_max.x : bb_min.x, (i & 2) != 0 ? bb_max.y : bb_min.y, (i & 4) != 0 ? bb_max.z : bb_min.z);
+    vec4 p = ViewProject*vec4(corner, 1);
+    outside_low += vec3(lessThan(p.xyz, vec3(-p.w)));
+    outside_high += vec3(greaterThan(p.xyz, vec3(p.w)));
+    }
+  // invisible when all corners are outside the same clip plane
+  return all(lessThan(outside_low, vec3(8))) && all(lessThan(outside_high, vec3(8)));
+  }
+
+void main()
+  {
+  uint id = gl_GlobalInvocationID.x;
+  if (id >= uint(NumberOfObjects))
+    return;
+  if (is_visible(objects[id].bb_min.xyz, objects[id].bb_max.xyz))
+    {
+    uint slot = atomicAdd(count, 1u);
+    commands[slot] = objects[id].command;
+    }
+  }
+)");
+    }
+
+  gpu_culling::gpu_culling()
+    {
+    clear_cs_handle = -1;
+    cull_cs_handle = -1;
+    clear_program_handle = -1;
+    cull_program_handle = -1;
+    object_buffer_handle = -1;
+    command_buffer_handle = -1;
+    count_buffer_handle = -1;
+    vp_handle = -1;
+    number_of_objects_handle = -1;
+    max_objects = 0;
+    number_of_objects = 0;
+    pool_version = 0;
+    }
+
+  gpu_culling::~gpu_culling()
+    {
+    }
+
+  void gpu_culling::destroy(render_engine* engine)
+    {
+    engine->remove_shader(clear_cs_handle);
+    engine->remove_shader(cull_cs_handle);
+    engine->remove_program(clear_program_handle);
+    engine->remove_program(cull_program_handle);
+    // the culling and the indirect draws of the frames in flight may still use them
+    engine->remove_deferred(RESOURCE_BUFFER_OBJECT, object_buffer_handle);
+    engine->remove_deferred(RESOURCE_BUFFER_OBJECT, command_buffer_handle);
+    engine->remove_deferred(RESOURCE_BUFFER_OBJECT, count_buffer_handle);
+    engine->remove_uniform(vp_handle);
+    engine->remove_uniform(number_of_objects_handle);
+    object_buffer_handle = -1;
+    command_buffer_handle = -1;
+    count_buffer_handle = -1;
+    max_objects = 0;
+    number_of_objects = 0;
+    }
+
+  void gpu_culling::compile(render_engine* engine, int32_t max_number_of_objects)
+    {
+    if (engine->get_renderer_type() == renderer_type::METAL)
+      {
+      clear_cs_handle = engine->add_shader(nullptr, SHADER_COMPUTE, "culling_clear_kernel");
+      cull_cs_handle = engine->add_shader(nullptr, SHADER_COMPUTE, "culling_kernel");
+      }
+    else if (engine->get_renderer_type() == renderer_type::OPENGL)
+      {
+      clear_cs_handle = engine->add_shader(get_culling_clear_shader().c_str(), SHADER_COMPUTE, nullptr);
+      cull_cs_handle = engine->add_shader(get_culling_shader().c_str(), SHADER_COMPUTE, nullptr);
+      }
+    clear_program_handle = engine->add_program(-1, -1, clear_cs_handle);
+    cull_program_handle = engine->add_program(-1, -1, cull_cs_handle);
+    vp_handle = engine->add_uniform("ViewProject", uniform_type::mat4, 1);
+    number_of_objects_handle = engine->add_uniform("NumberOfObjects", uniform_type::integer, 1);
+
+    max_objects = max_number_of_objects;
+    number_of_objects = 0;
+    object_buffer_handle = engine->add_buffer_object(nullptr, max_objects * sizeof(cull_object), COMPUTE_BUFFER);
+    command_buffer_handle = engine->add_buffer_object(nullptr, max_objects * sizeof(draw_indirect_command), COMPUTE_BUFFER);
+    count_buffer_handle = engine->add_buffer_object(nullptr, sizeof(uint32_t), COMPUTE_BUFFER);
+    }
+
+  void gpu_culling::set_objects(render_engine* engine, const draw_command* commands, const float4* bb_min, const float4* bb_max, int32_t number_of_new_objects)
+    {
+    source_commands.assign(commands, commands + number_of_new_objects);
+    source_bb_min.assign(bb_min, bb_min + number_of_new_objects);
+    source_bb_max.assign(bb_max, bb_max + number_of_new_objects);
+    upload_objects(engine);
+    }
+
+  void gpu_culling::upload_objects(render_engine* engine)
+    {
+    pool_version = engine->get_geometry_pool_version();
+    objects.clear();
+    for (size_t i = 0; i < source_commands.size() && (int32_t)objects.size() < max_objects; ++i)
+      {
+      cull_object obj;
+      if (!engine->get_draw_indirect_command(source_commands[i], obj.command))
+        continue;
+      obj.bb_min = source_bb_min[i];
+      obj.bb_max = source_bb_max[i];
+      obj.padding[0] = obj.padding[1] = obj.padding[2] = 0;
+      objects.push_back(obj);
+      }
+    number_of_objects = (int32_t)objects.size();
+    if (number_of_objects > 0)
+      engine->update_buffer_object(object_buffer_handle, objects.data(), number_of_objects * sizeof(cull_object));
+    }
+
+  void gpu_culling::cull(render_engine* engine)
+    {
+    if (max_objects == 0)
+      return;
+    if (pool_version != engine->get_geometry_pool_version()) // the absolute index ranges of the commands moved
+      upload_objects(engine);
+    // the clear pass also resets the commands that the culling pass leaves untouched, for backends without a draw count
+    int32_t num_groups = (max_objects + CULLING_LOCAL_SIZE - 1) / CULLING_LOCAL_SIZE;
+    int32_t number_to_clear = max_objects;
+    engine->bind_program(clear_program_handle);
+    engine->set_uniform(number_of_objects_handle, (void*)&number_to_clear);
+    engine->bind_uniform(clear_program_handle, number_of_objects_handle);
+    engine->bind_buffer_object(command_buffer_handle, 1);
+    engine->bind_buffer_object(count_buffer_handle, 2);
+    engine->dispatch_compute(num_groups, 1, 1, CULLING_LOCAL_SIZE, 1, 1);
+
+    if (number_of_objects == 0)
+      return;
+    num_groups = (number_of_objects + CULLING_LOCAL_SIZE - 1) / CULLING_LOCAL_SIZE;
+    engine->bind_program(cull_program_handle);
+    engine->set_uniform(vp_handle, (void*)(&engine->get_view_project()));
+    engine->set_uniform(number_of_objects_handle, (void*)&number_of_objects);
+    engine->bind_uniform(cull_program_handle, vp_handle);
+    engine->bind_uniform(cull_program_handle, number_of_objects_handle);
+    engine->bind_buffer_object(object_buffer_handle, 0);
+    engine->bind_buffer_object(command_buffer_handle, 1);
+    engine->bind_buffer_object(count_buffer_handle, 2);
+    engine->dispatch_compute(num_groups, 1, 1, CULLING_LOCAL_SIZE, 1, 1);
+    }
+
+  }
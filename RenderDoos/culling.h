@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "float.h"
+#include "render_context.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+
+  struct cull_object // input of the culling compute shader, std430 and metal layout
+    {
+    float4 bb_min; // world space bounding box, w is unused
+    float4 bb_max;
+    draw_indirect_command command; // written to the command buffer when the bounding box intersects the view frustum
+    uint32_t padding[3];
+    };
+
+  // frustum culling on the gpu. A compute pass tests the bounding boxes of the objects against the view projection of the
+  // engine and appends the draw commands of the visible objects to the command buffer, with their number in the count
+  // buffer. Draw the result with geometry_draw_indirect, the cpu never reads it back.
+  class gpu_culling
+    {
+    public:
+      gpu_culling();
+      ~gpu_culling();
+
+      void compile(render_engine* engine, int32_t max_objects);
+      void destroy(render_engine* engine);
+
+      // commands that get_draw_indirect_command rejects are skipped. All commands should share the buffers and vertex
+      // layout of the geometry passed to geometry_draw_indirect, e.g. by using pooled geometry or submeshes. The commands
+      // are resolved again in cull when pooled geometry moved, e.g. by defragment_geometry_pools.
+      void set_objects(render_engine* engine, const draw_command* commands, const float4* bb_min, const float4* bb_max, int32_t number_of_objects);
+
+      // call inside a renderpass with compute_shader set to true, after set_model_view_properties
+      void cull(render_engine* engine);
+
+      int32_t get_command_buffer() const { return command_buffer_handle; }
+      int32_t get_count_buffer() const { return count_buffer_handle; }
+      int32_t get_max_commands() const { return max_objects; }
+
+    private:
+      void upload_objects(render_engine* engine);
+
+    private:
+      int32_t clear_cs_handle, cull_cs_handle;
+      int32_t clear_program_handle, cull_program_handle;
+      int32_t object_buffer_handle, command_buffer_handle, count_buffer_handle;
+      int32_t vp_handle, number_of_objects_handle; // uniforms
+      int32_t max_objects, number_of_objects;
+      std::vector<cull_object> objects;
+      std::vector<draw_command> source_commands;
+      std::vector<float4> source_bb_min, source_bb_max;
+      uint32_t pool_version; // of the engine when objects were resolved
+    };
+
+  }
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include "render_engine.h"
+
+namespace RenderDoos
+  {
+
+  // typed compute buffer with a cpu mirror. Writes through operator[], push_back and resize mark dirty element ranges, and
+  // only those ranges are sent to the gpu by flush. bind flushes first, call flush after frame_begin for arrays that the
+  // gpu reads without a bind of their own. The layout of T should match the std430 layout of the shader.
+  template <class T>
+  class gpu_array
+    {
+    static_assert(std::is_trivially_copyable<T>::value, "gpu_array elements are copied bytewise");
+
+    public:
+      gpu_array() : engine(nullptr), buffer(-1), buffer_type(COMPUTE_BUFFER), download_readback(-1), download_count(0)
+        {
+        }
+
+      ~gpu_array()
+        {
+        }
+
+      void init(render_engine* e, int32_t type = COMPUTE_BUFFER) // streaming buffers do not keep unchanged ranges, so BUFFER_STREAMING is dropped from type
+        {
+        engine = e;
+        buffer_type = type & ~BUFFER_STREAMING;
+        }
+
+      void destroy() // the gpu buffer is removed once the frames in flight are done with it
+        {
+        finish_download(); // releases the readback handle
+        if (buffer >= 0)
+          engine->remove_deferred(RESOURCE_BUFFER_OBJECT, buffer);
+        buffer = -1;
+        elements.clear();
+        dirty.clear();
+        }
+
+      T& operator[](size_t i)
+        {
+        _mark_dirty(i, 1);
+        return elements[i];
+        }
+
+      const T& operator[](size_t i) const
+        {
+        return elements[i];
+        }
+
+      void push_back(const T& value)
+        {
+        elements.push_back(value);
+        _mark_dirty(elements.size() - 1, 1);
+        }
+
+      void resize(size_t count, const T& value = T())
+        {
+        size_t old_count = elements.size();
+        elements.resize(count, value);
+        if (count > old_count)
+          _mark_dirty(old_count, count - old_count);
+        }
+
+      void clear()
+        {
+        elements.clear();
+        dirty.clear();
+        }
+
+      void mark_dirty(size_t first, size_t count) // after writes through data()
+        {
+        _mark_dirty(first, count);
+        }
+
+      size_t size() const { return elements.size(); }
+      bool empty() const { return elements.empty(); }
+      T* data() { return elements.data(); } // writes through the pointer need mark_dirty
+      const T* data() const { return elements.data(); }
+      int32_t get_buffer() const { return buffer; } // -1 until the first flush
+
+      void flush() // sends the dirty ranges, the first flush creates the buffer
+        {
+        if (elements.empty())
+          {
+          dirty.clear();
+          return;
+          }
+        if (buffer < 0)
+          {
+          buffer = engine->add_buffer_object(elements.data(), (int32_t)(elements.size() * sizeof(T)), buffer_type);
+          dirty.clear();
+          return;
+          }
+        if (dirty.empty())
+          return;
+        std::sort(dirty.begin(), dirty.end(), [](const element_range& a, const element_range& b) { return a.first < b.first; });
+        size_t merged = 0;
+        for (size_t i = 1; i < dirty.size(); ++i)
+          {
+          if (dirty[i].first <= dirty[merged].last)
+            dirty[merged].last = std::max(dirty[merged].last, dirty[i].last);
+          else
+            dirty[++merged] = dirty[i];
+          }
+        dirty.resize(merged + 1);
+        if (dirty.size() > MAX_DIRTY_RANGES) // many scattered writes, one span costs less than many small updates
+          {
+          dirty.front().last = dirty.back().last;
+          dirty.resize(1);
+          }
+        for (const auto& range : dirty)
+          {
+          size_t last = std::min(range.last, elements.size()); // elements may have been removed by resize
+          if (range.first >= last)
+            continue;
+          engine->update_buffer_object(buffer, elements.data() + range.first, (int32_t)((last - range.first) * sizeof(T)), (int32_t)(range.first * sizeof(T)));
+          }
+        dirty.clear();
+        }
+
+      void bind(int32_t channel, int32_t target = BIND_TO_DEFAULT)
+        {
+        flush();
+        if (buffer >= 0)
+          engine->bind_buffer_object(buffer, channel, target);
+        }
+
+      // starts an asynchronous copy of the gpu buffer into the cpu mirror, e.g. after a compute shader wrote it. Returns false
+      // if a download is pending or no readback handle is free. The mirror is updated by finish_download.
+      bool download()
+        {
+        flush();
+        if (buffer < 0 || download_readback >= 0)
+          return false;
+        download_count = elements.size();
+        download_readback = engine->readback_buffer_object(buffer, (int32_t)(download_count * sizeof(T)));
+        return download_readback >= 0;
+        }
+
+      bool is_download_ready() const
+        {
+        return download_readback >= 0 && engine->is_readback_ready(download_readback);
+        }
+
+      void finish_download() // waits for the copy if needed. Elements written since download are overwritten.
+        {
+        if (download_readback < 0)
+          return;
+        std::vector<T> downloaded(download_count);
+        engine->finish_readback(download_readback, downloaded.data());
+        download_readback = -1;
+        size_t count = std::min(download_count, elements.size());
+        std::copy(downloaded.begin(), downloaded.begin() + count, elements.begin());
+        }
+
+    private:
+      struct element_range
+        {
+        size_t first;
+        size_t last; // one past the end
+        };
+
+      void _mark_dirty(size_t first, size_t count)
+        {
+        if (count == 0)
+          return;
+        if (!dirty.empty() && first <= dirty.back().last && first + count >= dirty.back().first) // touches the last range, e.g. sequential writes
+          {
+          dirty.back().first = std::min(dirty.back().first, first);
+          dirty.back().last = std::max(dirty.back().last, first + count);
+          return;
+          }
+        element_range range;
+        range.first = first;
+        range.last = first + count;
+        dirty.push_back(range);
+        }
+
+    private:
+      render_engine* engine;
+      int32_t buffer;
+      int32_t buffer_type;
+      std::vector<T> elements; // cpu mirror
+      std::vector<element_range> dirty; // merged in flush
+      int32_t download_readback;
+      size_t download_count;
+    };
+
+  }
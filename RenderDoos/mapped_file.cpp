@@ -0,0 +1,120 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace RenderDoos
+  {
+
+#ifdef _WIN32
+  mapped_file::mapped_file() : _data(nullptr), _size(0), _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+    {
+    }
+#else
+  mapped_file::mapped_file() : _data(nullptr), _size(0)
+    {
+    }
+#endif
+
+  mapped_file::~mapped_file()
+    {
+    close();
+    }
+
+#ifdef _WIN32
+  bool mapped_file::open(const char* filename)
+    {
+    close();
+    _file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (_file == INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(_file, &file_size) || file_size.QuadPart == 0)
+      {
+      close();
+      return false;
+      }
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!_mapping)
+      {
+      close();
+      return false;
+      }
+    _data = (const uint8_t*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!_data)
+      {
+      close();
+      return false;
+      }
+    _size = (uint64_t)file_size.QuadPart;
+    return true;
+    }
+
+  void mapped_file::close()
+    {
+    if (_data)
+      UnmapViewOfFile(_data);
+    if (_mapping)
+      CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE)
+      CloseHandle(_file);
+    _data = nullptr;
+    _size = 0;
+    _mapping = nullptr;
+    _file = INVALID_HANDLE_VALUE;
+    }
+
+  void mapped_file::prefetch(uint64_t, uint64_t) const
+    {
+    // FILE_FLAG_SEQUENTIAL_SCAN already makes the cache manager read ahead
+    }
+#else
+  bool mapped_file::open(const char* filename)
+    {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0)
+      {
+      ::close(fd);
+      return false;
+      }
+    void* p = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file open
+    if (p == MAP_FAILED)
+      return false;
+    madvise(p, (size_t)info.st_size, MADV_SEQUENTIAL);
+    _data = (const uint8_t*)p;
+    _size = (uint64_t)info.st_size;
+    return true;
+    }
+
+  void mapped_file::close()
+    {
+    if (_data)
+      munmap((void*)_data, (size_t)_size);
+    _data = nullptr;
+    _size = 0;
+    }
+
+  void mapped_file::prefetch(uint64_t offset, uint64_t size) const
+    {
+    if (!_data || offset >= _size)
+      return;
+    if (size > _size - offset)
+      size = _size - offset;
+    const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t first = offset & ~(page_size - 1); // madvise wants a page aligned address
+    madvise((void*)(_data + first), (size_t)(offset + size - first), MADV_WILLNEED);
+    }
+#endif
+
+  }
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace RenderDoos
+  {
+
+  // read only memory mapping of a whole file, the pages are read from disk when they are first touched
+  class mapped_file
+    {
+    public:
+      mapped_file();
+      ~mapped_file();
+
+      bool open(const char* filename); // false if the file cannot be mapped or is empty
+      void close();
+
+      void prefetch(uint64_t offset, uint64_t size) const; // asks the os to start reading the range, returns immediately
+
+      const uint8_t* data() const { return _data; }
+      uint64_t size() const { return _size; }
+      bool is_open() const { return _data != nullptr; }
+
+    private:
+      mapped_file(const mapped_file&) = delete;
+      mapped_file& operator = (const mapped_file&) = delete;
+
+    private:
+      const uint8_t* _data;
+      uint64_t _size;
+#ifdef _WIN32
+      void* _file;
+      void* _mapping;
+#endif
+    };
+
+  }
@@ -6,11 +6,91 @@
 namespace RenderDoos
   {
 
+  static std::string get_quantization_shader_functions()
+    {
+    return std::string(R"(#define QUANTIZED
+layout (location = 6) in vec3 vQuantizationOffset;
+layout (location = 7) in vec3 vQuantizationExtent;
+
+vec3 decode_position(vec3 p)
+  {
+  return vQuantizationOffset + vQuantizationExtent*p;
+  }
+
+vec3 decode_octahedral(vec2 e)
+  {
+  vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+  }
+)");
+    }
+
+  // the channels and the generic attribute location are fixed by render_context_gl
+  static std::string get_vertex_pulling_shader_functions()
+    {
+    return std::string(R"(#define VERTEX_PULLING
+layout (location = 5) in ivec4 vPulling; // first index, base vertex, index size, words per vertex
+layout (std430, binding = 14) readonly buffer PulledVertices { uint vertex_words[]; };
+layout (std430, binding = 15) readonly buffer PulledIndices { uint index_words[]; };
+
+uint fetch_vertex()
+  {
+  uint i = uint(vPulling.x + gl_VertexID);
+  uint index = vPulling.z == 2 ? (index_words[i >> 1] >> ((i & 1u) * 16u)) & 0xffffu : index_words[i];
+  return uint(int(index) + vPulling.y);
+  }
+
+uint vertex_word(uint vertex, int word)
+  {
+  return vertex_words[vertex * uint(vPulling.w) + uint(word)];
+  }
+)");
+    }
+
+  // inserts the code for the requested variant right after the #version line
+  static std::string get_variant_shader(const std::string& source, int32_t variant)
+    {
+    std::string::size_type eol = source.find('\n') + 1;
+    std::string version = source.substr(0, eol);
+    std::string header;
+    if (variant & MATERIAL_VARIANT_VERTEX_PULLING)
+      {
+      version = "#version 430 core\n"; // storage buffers
+      header.append(get_vertex_pulling_shader_functions());
+      }
+    if (variant & MATERIAL_VARIANT_QUANTIZED)
+      header.append(get_quantization_shader_functions());
+    if (variant & MATERIAL_VARIANT_INSTANCED)
+      header.append("#define INSTANCED\nlayout (location = 8) in mat4 vInstanceModel; // columns\n");
+    return version + header + source.substr(eol);
+    }
+
+  // metal shaders always fetch their vertices from buffer(0), so MATERIAL_VARIANT_VERTEX_PULLING needs no own shader
+  static std::string get_metal_vertex_shader_name(const char* material_name, int32_t variant)
+    {
+    std::string name(material_name);
+    if (variant & MATERIAL_VARIANT_QUANTIZED)
+      name.append("_quantized");
+    if (variant & MATERIAL_VARIANT_INSTANCED)
+      name.append("_instanced");
+    name.append("_vertex_shader");
+    return name;
+    }
+
   static std::string get_compact_material_vertex_shader()
     {
     return std::string(R"(#version 330 core
+#ifndef VERTEX_PULLING
+#ifdef QUANTIZED
+layout (location = 0) in vec3 vQuantizedPosition;
+#else
 layout (location = 0) in vec3 vPosition;
+#endif
 layout (location = 1) in uint vColor;
+#endif
 
 out vec4 Color;
 
@@ -19,8 +99,24 @@ uniform mat4 Camera; // columns
 
 void main() 
   {
+#if defined(VERTEX_PULLING) && defined(QUANTIZED)
+  uint v = fetch_vertex();
+  vec3 vQuantizedPosition = vec3(unpackUnorm2x16(vertex_word(v, 0)), unpackUnorm2x16(vertex_word(v, 1)).x);
+  uint vColor = vertex_word(v, 2);
+#elif defined(VERTEX_PULLING)
+  uint v = fetch_vertex();
+  vec3 vPosition = uintBitsToFloat(uvec3(vertex_word(v, 0), vertex_word(v, 1), vertex_word(v, 2)));
+  uint vColor = vertex_word(v, 3);
+#endif
+#ifdef QUANTIZED
+  vec3 vPosition = decode_position(vQuantizedPosition);
+#endif
   Color = vec4(float(vColor&uint(255))/255.f, float((vColor>>8)&uint(255))/255.f, float((vColor>>16)&uint(255))/255.f, float((vColor>>24)&uint(255))/255.f);
+#ifdef INSTANCED
+  gl_Position = ViewProject*(vInstanceModel*vec4(vPosition.xyz,1));
+#else
   gl_Position = ViewProject*vec4(vPosition.xyz,1); 
+#endif
   }
 )");
     }
@@ -43,12 +139,18 @@ void main()
     vs_handle = -1;
     fs_handle = -1;
     shader_program_handle = -1;
+    variant = 0;
     vp_handle = -1;
     }
 
   compact_material::~compact_material()
     {
     }
+
+  void compact_material::set_variant(int32_t variant_flags)
+    {
+    variant = variant_flags;
+    }
     
   void compact_material::destroy(render_engine* engine)
     {
@@ -62,12 +164,12 @@ void main()
     {
     if (engine->get_renderer_type() == renderer_type::METAL)
       {
-      vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "compact_material_vertex_shader");
+      vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, get_metal_vertex_shader_name("compact_material", variant).c_str());
       fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "compact_material_fragment_shader");
       }
     else if (engine->get_renderer_type() == renderer_type::OPENGL)
       {
-      vs_handle = engine->add_shader(get_compact_material_vertex_shader().c_str(), SHADER_VERTEX, nullptr);
+      vs_handle = engine->add_shader(get_variant_shader(get_compact_material_vertex_shader(), variant).c_str(), SHADER_VERTEX, nullptr);
       fs_handle = engine->add_shader(get_compact_material_fragment_shader().c_str(), SHADER_FRAGMENT, nullptr);
       }
     shader_program_handle = engine->add_program(vs_handle, fs_handle);
@@ -87,9 +189,16 @@ void main()
   static std::string get_vertex_colored_material_vertex_shader()
     {
     return std::string(R"(#version 330 core
+#ifndef VERTEX_PULLING
+#ifdef QUANTIZED
+layout (location = 0) in vec3 vQuantizedPosition;
+layout (location = 1) in vec2 vOctahedralNormal;
+#else
 layout (location = 0) in vec3 vPosition;
 layout (location = 1) in vec3 vNormal;
+#endif
 layout (location = 2) in uint vColor;
+#endif
 uniform mat4 ViewProject; // columns
 uniform mat4 Camera; // columns
 
@@ -98,8 +207,28 @@ out vec4 Color;
 
 void main() 
   {
+#if defined(VERTEX_PULLING) && defined(QUANTIZED)
+  uint v = fetch_vertex();
+  vec3 vQuantizedPosition = vec3(unpackUnorm2x16(vertex_word(v, 0)), unpackUnorm2x16(vertex_word(v, 1)).x);
+  vec2 vOctahedralNormal = unpackSnorm2x16(vertex_word(v, 2));
+  uint vColor = vertex_word(v, 3);
+#elif defined(VERTEX_PULLING)
+  uint v = fetch_vertex();
+  vec3 vPosition = uintBitsToFloat(uvec3(vertex_word(v, 0), vertex_word(v, 1), vertex_word(v, 2)));
+  vec3 vNormal = uintBitsToFloat(uvec3(vertex_word(v, 3), vertex_word(v, 4), vertex_word(v, 5)));
+  uint vColor = vertex_word(v, 6);
+#endif
+#ifdef QUANTIZED
+  vec3 vPosition = decode_position(vQuantizedPosition);
+  vec3 vNormal = decode_octahedral(vOctahedralNormal);
+#endif
+#ifdef INSTANCED
+  gl_Position = ViewProject*(vInstanceModel*vec4(vPosition.xyz,1));
+  Normal = (Camera*(vInstanceModel*vec4(vNormal,0))).xyz;
+#else
   gl_Position = ViewProject*vec4(vPosition.xyz,1);
   Normal = (Camera*vec4(vNormal,0)).xyz;  
+#endif
   Color = vec4(float(vColor&uint(255))/255.f, float((vColor>>8)&uint(255))/255.f, float((vColor>>16)&uint(255))/255.f, float((vColor>>24)&uint(255))/255.f);  
   }
 )");
@@ -130,6 +259,7 @@ void main()
     vs_handle = -1;
     fs_handle = -1;
     shader_program_handle = -1;
+    variant = 0;
     ambient = 0.2f;
     vp_handle = -1;
     cam_handle = -1;
@@ -141,6 +271,11 @@ void main()
     {
     }
 
+  void vertex_colored_material::set_variant(int32_t variant_flags)
+    {
+    variant = variant_flags;
+    }
+
   void vertex_colored_material::set_ambient(float a)
     {
     ambient = a;
@@ -161,12 +296,12 @@ void main()
     {
     if (engine->get_renderer_type() == renderer_type::METAL)
       {
-      vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "vertex_colored_material_vertex_shader");
+      vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, get_metal_vertex_shader_name("vertex_colored_material", variant).c_str());
       fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "vertex_colored_material_fragment_shader");
       }
     else if (engine->get_renderer_type() == renderer_type::OPENGL)
       {
-      vs_handle = engine->add_shader(get_vertex_colored_material_vertex_shader().c_str(), SHADER_VERTEX, nullptr);
+      vs_handle = engine->add_shader(get_variant_shader(get_vertex_colored_material_vertex_shader(), variant).c_str(), SHADER_VERTEX, nullptr);
       fs_handle = engine->add_shader(get_vertex_colored_material_fragment_shader().c_str(), SHADER_FRAGMENT, nullptr);
       }   
     shader_program_handle = engine->add_program(vs_handle, fs_handle);
@@ -198,9 +333,16 @@ void main()
   static std::string get_simple_material_vertex_shader()
     {
     return std::string(R"(#version 330 core
+#ifndef VERTEX_PULLING
+#ifdef QUANTIZED
+layout (location = 0) in vec3 vQuantizedPosition;
+layout (location = 1) in vec2 vOctahedralNormal;
+#else
 layout (location = 0) in vec3 vPosition;
 layout (location = 1) in vec3 vNormal;
+#endif
 layout (location = 2) in vec2 vTexCoord;
+#endif
 uniform mat4 ViewProject; // columns
 uniform mat4 Camera; // columns
 
@@ -209,8 +351,28 @@ out vec2 TexCoord;
 
 void main() 
   {
+#if defined(VERTEX_PULLING) && defined(QUANTIZED)
+  uint v = fetch_vertex();
+  vec3 vQuantizedPosition = vec3(unpackUnorm2x16(vertex_word(v, 0)), unpackUnorm2x16(vertex_word(v, 1)).x);
+  vec2 vOctahedralNormal = unpackSnorm2x16(vertex_word(v, 2));
+  vec2 vTexCoord = unpackHalf2x16(vertex_word(v, 3));
+#elif defined(VERTEX_PULLING)
+  uint v = fetch_vertex();
+  vec3 vPosition = uintBitsToFloat(uvec3(vertex_word(v, 0), vertex_word(v, 1), vertex_word(v, 2)));
+  vec3 vNormal = uintBitsToFloat(uvec3(vertex_word(v, 3), vertex_word(v, 4), vertex_word(v, 5)));
+  vec2 vTexCoord = uintBitsToFloat(uvec2(vertex_word(v, 6), vertex_word(v, 7)));
+#endif
+#ifdef QUANTIZED
+  vec3 vPosition = decode_position(vQuantizedPosition);
+  vec3 vNormal = decode_octahedral(vOctahedralNormal);
+#endif
+#ifdef INSTANCED
+  gl_Position = ViewProject*(vInstanceModel*vec4(vPosition.xyz,1));
+  Normal = (Camera*(vInstanceModel*vec4(vNormal,0))).xyz;
+#else
   gl_Position = ViewProject*vec4(vPosition.xyz,1);
   Normal = (Camera*vec4(vNormal,0)).xyz;
+#endif
   TexCoord = vTexCoord;
   }
 )");
@@ -244,6 +406,7 @@ void main()
     vs_handle = -1;
     fs_handle = -1;
     shader_program_handle = -1;
+    variant = 0;
     tex_handle = -1;
     color = 0xff0000ff;
     ambient = 0.2f;
@@ -261,6 +424,11 @@ void main()
     {
     }
 
+  void simple_material::set_variant(int32_t variant_flags)
+    {
+    variant = variant_flags;
+    }
+
   void simple_material::set_texture(int32_t handle, int32_t flags)
     {
     if (handle >= 0 && handle < MAX_TEXTURE)
@@ -300,12 +468,12 @@ void main()
     {
     if (engine->get_renderer_type() == renderer_type::METAL)
       {
-      vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "simple_material_vertex_shader");
+      vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, get_metal_vertex_shader_name("simple_material", variant).c_str());
       fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "simple_material_fragment_shader");
       }
     else if (engine->get_renderer_type() == renderer_type::OPENGL)
       {
-      vs_handle = engine->add_shader(get_simple_material_vertex_shader().c_str(), SHADER_VERTEX, nullptr);
+      vs_handle = engine->add_shader(get_variant_shader(get_simple_material_vertex_shader(), variant).c_str(), SHADER_VERTEX, nullptr);
       fs_handle = engine->add_shader(get_simple_material_fragment_shader().c_str(), SHADER_FRAGMENT, nullptr);
       }
     dummy_tex_handle = engine->add_texture(1, 1, texture_format_rgba8, (const uint16_t*)nullptr);
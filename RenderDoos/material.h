@@ -7,6 +7,10 @@ namespace RenderDoos
   {
   class render_engine;  
 
+#define MATERIAL_VARIANT_QUANTIZED 1 // decodes VERTEX_STANDARD_QUANTIZED, VERTEX_COMPACT_QUANTIZED or VERTEX_COLOR_QUANTIZED vertices
+#define MATERIAL_VARIANT_VERTEX_PULLING 2 // fetches vertices and indices from storage buffers, for geometry with GEOMETRY_VERTEX_PULLING
+#define MATERIAL_VARIANT_INSTANCED 4 // transforms by the per instance model matrix of set_geometry_instances
+
   class material
     {
     public:
@@ -15,6 +19,10 @@ namespace RenderDoos
       virtual void compile(render_engine* engine) = 0;
       virtual void bind(render_engine* engine) = 0;
       virtual void destroy(render_engine* engine) = 0;
+
+      // state that a render_queue sorts on, -1 if not used
+      virtual int32_t get_program() const { return -1; }
+      virtual int32_t get_texture() const { return -1; }
     };
 
   class compact_material : public material
@@ -22,13 +30,18 @@ namespace RenderDoos
     public:
       compact_material();
       virtual ~compact_material();
+
+      void set_variant(int32_t variant_flags); // call before compile
+
       virtual void compile(render_engine* engine);
       virtual void bind(render_engine* engine);
       virtual void destroy(render_engine* engine);
+      virtual int32_t get_program() const { return shader_program_handle; }
       
     private:
       int32_t vs_handle, fs_handle;
       int32_t shader_program_handle;
+      int32_t variant;
       int32_t vp_handle;
     };
 
@@ -39,14 +52,17 @@ namespace RenderDoos
       virtual ~vertex_colored_material();
 
       void set_ambient(float a);
+      void set_variant(int32_t variant_flags); // call before compile
 
       virtual void compile(render_engine* engine);
       virtual void bind(render_engine* engine);
       virtual void destroy(render_engine* engine);
+      virtual int32_t get_program() const { return shader_program_handle; }
 
     private:
       int32_t vs_handle, fs_handle;
       int32_t shader_program_handle;
+      int32_t variant;
       float ambient;
       int32_t texture_flags;
       int32_t vp_handle, cam_handle, light_dir_handle, ambient_handle; // uniforms
@@ -61,14 +77,18 @@ namespace RenderDoos
       void set_texture(int32_t handle, int32_t flags);
       void set_color(uint32_t clr);
       void set_ambient(float a);
+      void set_variant(int32_t variant_flags); // call before compile
 
       virtual void compile(render_engine* engine);
       virtual void bind(render_engine* engine);
       virtual void destroy(render_engine* engine);
+      virtual int32_t get_program() const { return shader_program_handle; }
+      virtual int32_t get_texture() const { return tex_handle; }
 
     private:
       int32_t vs_handle, fs_handle;
       int32_t shader_program_handle;
+      int32_t variant;
       int32_t tex_handle, dummy_tex_handle;
       uint32_t color; // if no texture is set
       float ambient;
@@ -95,6 +115,7 @@ namespace RenderDoos
       virtual void compile(render_engine* engine);
       virtual void bind(render_engine* engine);
       virtual void destroy(render_engine* engine);
+      virtual int32_t get_program() const { return shader_program_handle; }
       
     private:
       int32_t vs_handle, fs_handle;
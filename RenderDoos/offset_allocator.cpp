@@ -0,0 +1,119 @@
+#include "offset_allocator.h"
+
+#include <iterator>
+
+namespace RenderDoos
+  {
+
+  offset_allocator::offset_allocator() : _size(0), _used(0)
+    {
+    }
+
+  void offset_allocator::init(uint32_t size)
+    {
+    _free_by_offset.clear();
+    _free_by_size.clear();
+    _allocations.clear();
+    _size = size;
+    _used = 0;
+    if (size > 0)
+      _insert_free(0, size);
+    }
+
+  void offset_allocator::grow(uint32_t new_size)
+    {
+    if (new_size <= _size)
+      return;
+    uint32_t offset = _size;
+    uint32_t size = new_size - _size;
+    if (!_free_by_offset.empty())
+      {
+      auto last = std::prev(_free_by_offset.end());
+      if (last->first + last->second == _size) // join with the free range at the end
+        {
+        offset = last->first;
+        size += last->second;
+        _erase_free(last);
+        }
+      }
+    _insert_free(offset, size);
+    _size = new_size;
+    }
+
+  uint32_t offset_allocator::allocate(uint32_t size)
+    {
+    if (size == 0)
+      size = 1;
+    auto best = _free_by_size.lower_bound(size);
+    if (best == _free_by_size.end())
+      return OFFSET_ALLOCATOR_INVALID;
+    uint32_t offset = best->second;
+    uint32_t free_size = best->first;
+    _erase_free(_free_by_offset.find(offset));
+    if (free_size > size)
+      _insert_free(offset + size, free_size - size);
+    _allocations[offset] = size;
+    _used += size;
+    return offset;
+    }
+
+  void offset_allocator::free(uint32_t offset)
+    {
+    auto it = _allocations.find(offset);
+    if (it == _allocations.end())
+      return;
+    uint32_t size = it->second;
+    _allocations.erase(it);
+    _used -= size;
+    auto next = _free_by_offset.lower_bound(offset);
+    if (next != _free_by_offset.end() && next->first == offset + size)
+      {
+      size += next->second;
+      auto joined = next++;
+      _erase_free(joined);
+      }
+    if (next != _free_by_offset.begin())
+      {
+      auto previous = std::prev(next);
+      if (previous->first + previous->second == offset)
+        {
+        offset = previous->first;
+        size += previous->second;
+        _erase_free(previous);
+        }
+      }
+    _insert_free(offset, size);
+    }
+
+  uint32_t offset_allocator::get_allocation_size(uint32_t offset) const
+    {
+    auto it = _allocations.find(offset);
+    return it == _allocations.end() ? 0 : it->second;
+    }
+
+  uint32_t offset_allocator::get_largest_free_range() const
+    {
+    return _free_by_size.empty() ? 0 : std::prev(_free_by_size.end())->first;
+    }
+
+  void offset_allocator::_insert_free(uint32_t offset, uint32_t size)
+    {
+    _free_by_offset[offset] = size;
+    _free_by_size.insert(std::pair<uint32_t, uint32_t>(size, offset));
+    }
+
+  void offset_allocator::_erase_free(std::map<uint32_t, uint32_t>::iterator it)
+    {
+    auto range = _free_by_size.equal_range(it->second);
+    for (auto s = range.first; s != range.second; ++s)
+      {
+      if (s->second == it->first)
+        {
+        _free_by_size.erase(s);
+        break;
+        }
+      }
+    _free_by_offset.erase(it);
+    }
+
+  }
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+
+namespace RenderDoos
+  {
+
+#define OFFSET_ALLOCATOR_INVALID 0xffffffff
+
+  // hands out ranges [offset, offset + size) of a larger buffer. The smallest free range that fits is used (best fit),
+  // and freed ranges are joined with their free neighbours.
+  class offset_allocator
+    {
+    public:
+      offset_allocator();
+
+      void init(uint32_t size);
+      void grow(uint32_t new_size); // [size, new_size) becomes free
+
+      uint32_t allocate(uint32_t size); // returns OFFSET_ALLOCATOR_INVALID if no free range is large enough
+      void free(uint32_t offset);
+      uint32_t get_allocation_size(uint32_t offset) const; // 0 if offset is not allocated
+
+      uint32_t get_size() const { return _size; }
+      uint32_t get_used() const { return _used; }
+      uint32_t get_largest_free_range() const;
+
+    private:
+      void _insert_free(uint32_t offset, uint32_t size);
+      void _erase_free(std::map<uint32_t, uint32_t>::iterator it);
+
+    private:
+      uint32_t _size;
+      uint32_t _used;
+      std::map<uint32_t, uint32_t> _free_by_offset;    // offset -> size
+      std::multimap<uint32_t, uint32_t> _free_by_size; // size -> offset
+      std::map<uint32_t, uint32_t> _allocations;       // offset -> size
+    };
+
+  }
@@ -0,0 +1,315 @@
+#include "packing.h"
+
+#include <cmath>
+
+namespace RenderDoos
+  {
+
+  namespace
+    {
+    union float_bits
+      {
+      float f;
+      uint32_t u;
+      };
+
+#ifdef RENDERDOOS_SIMD
+    // round to nearest even, denormals are handled, NaN maps to a quiet NaN
+    __m128i float_to_half_4(__m128 f)
+      {
+      const __m128i sign_mask = _mm_set1_epi32(0x80000000);
+      const __m128i f32_infinity = _mm_set1_epi32(255 << 23);
+      const __m128i f16_max = _mm_set1_epi32((127 + 16) << 23);
+      const __m128i min_normal = _mm_set1_epi32(113 << 23);
+      const __m128i denorm_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+      const __m128i rebias = _mm_set1_epi32((int32_t)(((uint32_t)(15 - 127) << 23) + 0xfff));
+      const __m128i one = _mm_set1_epi32(1);
+
+      __m128i x = _mm_castps_si128(f);
+      __m128i sign = _mm_and_si128(x, sign_mask);
+      x = _mm_xor_si128(x, sign);
+
+      __m128i in_range = _mm_cmpgt_epi32(f16_max, x);
+      __m128i is_nan = _mm_cmpgt_epi32(x, f32_infinity);
+      __m128i is_denorm = _mm_cmpgt_epi32(min_normal, x);
+
+      __m128i inf_or_nan = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(is_nan, _mm_set1_epi32(0x0200)));
+
+      __m128i denorm = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(x), _mm_castsi128_ps(denorm_magic))), denorm_magic);
+
+      __m128i mant_odd = _mm_and_si128(_mm_srli_epi32(x, 13), one);
+      __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(x, rebias), mant_odd), 13);
+
+      __m128i finite = _mm_or_si128(_mm_and_si128(is_denorm, denorm), _mm_andnot_si128(is_denorm, normal));
+      __m128i result = _mm_or_si128(_mm_and_si128(in_range, finite), _mm_andnot_si128(in_range, inf_or_nan));
+      return _mm_or_si128(result, _mm_srli_epi32(sign, 16));
+      }
+
+    __m128 load3(const float* p)
+      {
+      const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+      return _mm_and_ps(_mm_loadu_ps(p), mask);
+      }
+
+    void store_position(uint16_t* out, const float* p, __m128 offset, __m128 scale)
+      {
+      __m128 v = _mm_mul_ps(_mm_sub_ps(load3(p), offset), scale);
+      v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(65535.f));
+      __m128i vi = _mm_cvtps_epi32(v);
+      vi = _mm_packus_epi32(vi, vi);
+      _mm_storel_epi64((__m128i*)out, vi);
+      }
+
+    void store_normal(int16_t* out, const float* n)
+      {
+      const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+      __m128 v = load3(n);
+      __m128 a = _mm_and_ps(v, abs_mask);
+      __m128 l1 = _mm_dp_ps(a, _mm_set1_ps(1.f), 0x7F);
+      if (_mm_cvtss_f32(l1) > 0.f)
+        v = _mm_div_ps(v, l1);
+      __m128 z = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+      if (_mm_cvtss_f32(z) < 0.f)
+        {
+        __m128 yx = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 2, 0, 1));
+        __m128 folded = _mm_sub_ps(_mm_set1_ps(1.f), _mm_and_ps(yx, abs_mask));
+        __m128 sign = _mm_andnot_ps(abs_mask, v);
+        v = _mm_or_ps(folded, sign);
+        }
+      v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.f)), _mm_set1_ps(1.f));
+      __m128i vi = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(32767.f)));
+      vi = _mm_packs_epi32(vi, vi);
+      *(int32_t*)out = _mm_cvtsi128_si32(vi);
+      }
+
+    void store_uv(uint16_t* out, const float* uv)
+      {
+      __m128i h = float_to_half_4(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)uv)));
+      out[0] = (uint16_t)_mm_cvtsi128_si32(h);
+      out[1] = (uint16_t)_mm_cvtsi128_si32(_mm_srli_si128(h, 4));
+      }
+
+    void get_quantization(__m128& offset, __m128& scale, const float4& bb_min, const float4& bb_max)
+      {
+      offset = load3(bb_min.f);
+      __m128 extent = _mm_sub_ps(load3(bb_max.f), offset);
+      __m128 valid = _mm_cmpgt_ps(extent, _mm_setzero_ps());
+      scale = _mm_and_ps(valid, _mm_div_ps(_mm_set1_ps(65535.f), extent));
+      }
+
+    void bounding_box(float4& bb_min, float4& bb_max, const float* first, int32_t stride_in_floats, int32_t number_of_vertices)
+      {
+      __m128 mi = _mm_set1_ps(INFINITY);
+      __m128 ma = _mm_set1_ps(-INFINITY);
+      const float* p = first;
+      for (int32_t i = 0; i < number_of_vertices; ++i, p += stride_in_floats)
+        {
+        __m128 v = _mm_loadu_ps(p);
+        mi = _mm_min_ps(mi, v);
+        ma = _mm_max_ps(ma, v);
+        }
+      bb_min = float4(mi);
+      bb_max = float4(ma);
+      bb_min[3] = 1.f;
+      bb_max[3] = 1.f;
+      }
+#else
+    void store_position(uint16_t* out, const float* p, const float* offset, const float* scale)
+      {
+      for (int j = 0; j < 3; ++j)
+        {
+        float v = (p[j] - offset[j]) * scale[j];
+        v = v < 0.f ? 0.f : (v > 65535.f ? 65535.f : v);
+        out[j] = (uint16_t)(v + 0.5f);
+        }
+      out[3] = 0;
+      }
+
+    void store_normal(int16_t* out, const float* n)
+      {
+      encode_octahedral(out[0], out[1], n[0], n[1], n[2]);
+      }
+
+    void store_uv(uint16_t* out, const float* uv)
+      {
+      out[0] = float_to_half(uv[0]);
+      out[1] = float_to_half(uv[1]);
+      }
+
+    void get_quantization(float* offset, float* scale, const float4& bb_min, const float4& bb_max)
+      {
+      for (int j = 0; j < 3; ++j)
+        {
+        offset[j] = bb_min[j];
+        float extent = bb_max[j] - bb_min[j];
+        scale[j] = extent > 0.f ? 65535.f / extent : 0.f;
+        }
+      }
+
+    void bounding_box(float4& bb_min, float4& bb_max, const float* first, int32_t stride_in_floats, int32_t number_of_vertices)
+      {
+      bb_min = float4(INFINITY, INFINITY, INFINITY, 1.f);
+      bb_max = float4(-INFINITY, -INFINITY, -INFINITY, 1.f);
+      const float* p = first;
+      for (int32_t i = 0; i < number_of_vertices; ++i, p += stride_in_floats)
+        {
+        for (int j = 0; j < 3; ++j)
+          {
+          bb_min[j] = p[j] < bb_min[j] ? p[j] : bb_min[j];
+          bb_max[j] = p[j] > bb_max[j] ? p[j] : bb_max[j];
+          }
+        }
+      }
+#endif
+    }
+
+  uint16_t float_to_half(float f)
+    {
+    float_bits in;
+    in.f = f;
+    uint32_t x = in.u;
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+    uint16_t result;
+    if (x >= ((127 + 16) << 23))
+      result = (x > (255u << 23)) ? 0x7e00 : 0x7c00;
+    else if (x < (113 << 23))
+      {
+      float_bits magic;
+      magic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+      float_bits v;
+      v.u = x;
+      v.f += magic.f;
+      result = (uint16_t)(v.u - magic.u);
+      }
+    else
+      {
+      uint32_t mant_odd = (x >> 13) & 1;
+      x += ((uint32_t)(15 - 127) << 23) + 0xfff;
+      x += mant_odd;
+      result = (uint16_t)(x >> 13);
+      }
+    return result | (uint16_t)(sign >> 16);
+    }
+
+  float half_to_float(uint16_t h)
+    {
+    float_bits magic;
+    magic.u = 113 << 23;
+    float_bits out;
+    out.u = (h & 0x7fff) << 13;
+    uint32_t exp = 0x7c00u << 13;
+    uint32_t e = out.u & exp;
+    out.u += (127 - 15) << 23;
+    if (e == exp)
+      out.u += (128 - 16) << 23;
+    else if (e == 0)
+      {
+      out.u += 1 << 23;
+      out.f -= magic.f;
+      }
+    out.u |= (h & 0x8000u) << 16;
+    return out.f;
+    }
+
+  void encode_octahedral(int16_t& ox, int16_t& oy, float nx, float ny, float nz)
+    {
+    float l1 = std::abs(nx) + std::abs(ny) + std::abs(nz);
+    if (l1 > 0.f)
+      {
+      nx /= l1;
+      ny /= l1;
+      nz /= l1;
+      }
+    if (nz < 0.f)
+      {
+      float x = (1.f - std::abs(ny)) * (nx >= 0.f ? 1.f : -1.f);
+      float y = (1.f - std::abs(nx)) * (ny >= 0.f ? 1.f : -1.f);
+      nx = x;
+      ny = y;
+      }
+    nx = nx < -1.f ? -1.f : (nx > 1.f ? 1.f : nx);
+    ny = ny < -1.f ? -1.f : (ny > 1.f ? 1.f : ny);
+    ox = (int16_t)std::lround(nx * 32767.f);
+    oy = (int16_t)std::lround(ny * 32767.f);
+    }
+
+  void compute_bounding_box(float4& bb_min, float4& bb_max, const vertex_standard* vertices, int32_t number_of_vertices)
+    {
+    bounding_box(bb_min, bb_max, &vertices->x, sizeof(vertex_standard) / sizeof(float), number_of_vertices);
+    }
+
+  void compute_bounding_box(float4& bb_min, float4& bb_max, const vertex_compact* vertices, int32_t number_of_vertices)
+    {
+    bounding_box(bb_min, bb_max, &vertices->x, sizeof(vertex_compact) / sizeof(float), number_of_vertices);
+    }
+
+  void compute_bounding_box(float4& bb_min, float4& bb_max, const vertex_color* vertices, int32_t number_of_vertices)
+    {
+    bounding_box(bb_min, bb_max, &vertices->x, sizeof(vertex_color) / sizeof(float), number_of_vertices);
+    }
+
+  void quantize_vertices(vertex_standard_quantized* out, const vertex_standard* vertices, int32_t number_of_vertices, const float4& bb_min, const float4& bb_max)
+    {
+#ifdef RENDERDOOS_SIMD
+    __m128 offset, scale;
+#else
+    float offset[3], scale[3];
+#endif
+    get_quantization(offset, scale, bb_min, bb_max);
+    for (int32_t i = 0; i < number_of_vertices; ++i, ++out, ++vertices)
+      {
+      store_position(&out->x, &vertices->x, offset, scale);
+      store_normal(&out->nx, &vertices->nx);
+      store_uv(&out->u, &vertices->u);
+      }
+    }
+
+  void quantize_vertices(vertex_compact_quantized* out, const vertex_compact* vertices, int32_t number_of_vertices, const float4& bb_min, const float4& bb_max)
+    {
+#ifdef RENDERDOOS_SIMD
+    __m128 offset, scale;
+#else
+    float offset[3], scale[3];
+#endif
+    get_quantization(offset, scale, bb_min, bb_max);
+    for (int32_t i = 0; i < number_of_vertices; ++i, ++out, ++vertices)
+      {
+      store_position(&out->x, &vertices->x, offset, scale);
+      out->c0 = vertices->c0;
+      }
+    }
+
+  void quantize_vertices(vertex_color_quantized* out, const vertex_color* vertices, int32_t number_of_vertices, const float4& bb_min, const float4& bb_max)
+    {
+#ifdef RENDERDOOS_SIMD
+    __m128 offset, scale;
+#else
+    float offset[3], scale[3];
+#endif
+    get_quantization(offset, scale, bb_min, bb_max);
+    for (int32_t i = 0; i < number_of_vertices; ++i, ++out, ++vertices)
+      {
+      store_position(&out->x, &vertices->x, offset, scale);
+      store_normal(&out->nx, &vertices->nx);
+      out->c0 = vertices->c0;
+      }
+    }
+
+  void narrow_indices(uint16_t* out, const uint32_t* indices, int32_t number_of_indices)
+    {
+    int32_t i = 0;
+#ifdef RENDERDOOS_SIMD
+    // reads run ahead of the writes, so narrowing in place is safe
+    for (; i + 8 <= number_of_indices; i += 8)
+      {
+      __m128i lo = _mm_loadu_si128((const __m128i*)(indices + i));
+      __m128i hi = _mm_loadu_si128((const __m128i*)(indices + i + 4));
+      _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi32(lo, hi));
+      }
+#endif
+    for (; i < number_of_indices; ++i)
+      out[i] = (uint16_t)indices[i];
+    }
+
+  }
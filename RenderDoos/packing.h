@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "float.h"
+#include "render_context.h"
+
+namespace RenderDoos
+  {
+
+  uint16_t float_to_half(float f);
+  float half_to_float(uint16_t h);
+
+  // octahedral normal encoding in two signed normalized 16-bit values
+  void encode_octahedral(int16_t& ox, int16_t& oy, float nx, float ny, float nz);
+
+  void compute_bounding_box(float4& bb_min, float4& bb_max, const vertex_standard* vertices, int32_t number_of_vertices);
+  void compute_bounding_box(float4& bb_min, float4& bb_max, const vertex_compact* vertices, int32_t number_of_vertices);
+  void compute_bounding_box(float4& bb_min, float4& bb_max, const vertex_color* vertices, int32_t number_of_vertices);
+
+  // positions are stored as 16-bit unsigned normalized values relative to the bounding box [bb_min, bb_max],
+  // use the same bounding box with set_geometry_quantization so that the shaders can decode them.
+  void quantize_vertices(vertex_standard_quantized* out, const vertex_standard* vertices, int32_t number_of_vertices, const float4& bb_min, const float4& bb_max);
+  void quantize_vertices(vertex_compact_quantized* out, const vertex_compact* vertices, int32_t number_of_vertices, const float4& bb_min, const float4& bb_max);
+  void quantize_vertices(vertex_color_quantized* out, const vertex_color* vertices, int32_t number_of_vertices, const float4& bb_min, const float4& bb_max);
+
+  // converts 32-bit indices to 16-bit indices, indices should be smaller than 65536. out may point to the same memory as indices.
+  void narrow_indices(uint16_t* out, const uint32_t* indices, int32_t number_of_indices);
+
+  }
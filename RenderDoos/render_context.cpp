@@ -1,6 +1,12 @@
 #include "render_context.h"
+#include "packing.h"
+#include "mapped_file.h"
+#include "types.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <stdexcept>
 
 namespace RenderDoos
   {
@@ -28,10 +34,146 @@ namespace RenderDoos
           { uniform_type::integer, sizeof(int32_t), 1},
           { uniform_type::real, sizeof(float), 1}
       };
+
+    // four independent lanes of 8 bytes per 32 byte stripe, so that the multiplies of the lanes overlap in the pipeline or
+    // end up in vector registers, followed by the tail and an avalanche of the result. The lanes are folded twice with
+    // different rotations into 128 bits, so that a match of the hash can stand in for comparing the bytes.
+    const uint64_t hash_prime_1 = 0x9E3779B185EBCA87ull;
+    const uint64_t hash_prime_2 = 0xC2B2AE3D27D4EB4Full;
+    const uint64_t hash_prime_3 = 0x165667B19E3779F9ull;
+
+    inline uint64_t rotate_left(uint64_t x, int r)
+      {
+      return (x << r) | (x >> (64 - r));
+      }
+
+    inline uint64_t hash_round(uint64_t lane, uint64_t input)
+      {
+      lane += input * hash_prime_2;
+      lane = rotate_left(lane, 31);
+      return lane * hash_prime_1;
+      }
+
+#ifdef RENDERDOOS_SIMD
+    inline __m128i mul_64(__m128i a, __m128i b) // low 64 bits of the products of the two 64-bit lanes
+      {
+      __m128i low = _mm_mul_epu32(a, b);
+      __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b), _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+      return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+      }
+
+    inline __m128i hash_round_2(__m128i lanes, __m128i input)
+      {
+      const __m128i prime_1 = _mm_set1_epi64x((int64_t)hash_prime_1);
+      const __m128i prime_2 = _mm_set1_epi64x((int64_t)hash_prime_2);
+      lanes = _mm_add_epi64(lanes, mul_64(input, prime_2));
+      lanes = _mm_or_si128(_mm_slli_epi64(lanes, 31), _mm_srli_epi64(lanes, 33));
+      return mul_64(lanes, prime_1);
+      }
+#endif
+
+    inline uint64_t read_uint64(const uint8_t* p)
+      {
+      uint64_t v;
+      memcpy(&v, p, sizeof(uint64_t));
+      return v;
+      }
+
+    inline uint64_t avalanche(uint64_t h)
+      {
+      h ^= h >> 33;
+      h *= hash_prime_2;
+      h ^= h >> 29;
+      h *= hash_prime_3;
+      h ^= h >> 32;
+      return h;
+      }
+
+    void hash_bytes(const uint8_t* data, size_t size, uint64_t seed, uint64_t hash[2])
+      {
+      uint64_t lanes[4] = { seed + hash_prime_1 + hash_prime_2, seed + hash_prime_2, seed, seed - hash_prime_1 };
+      size_t i = 0;
+#ifdef RENDERDOOS_SIMD
+      // two lanes per register, gives the same hash as the scalar rounds
+      __m128i lanes_01 = _mm_loadu_si128((const __m128i*)lanes);
+      __m128i lanes_23 = _mm_loadu_si128((const __m128i*)(lanes + 2));
+      for (; i + 32 <= size; i += 32)
+        {
+        lanes_01 = hash_round_2(lanes_01, _mm_loadu_si128((const __m128i*)(data + i)));
+        lanes_23 = hash_round_2(lanes_23, _mm_loadu_si128((const __m128i*)(data + i + 16)));
+        }
+      _mm_storeu_si128((__m128i*)lanes, lanes_01);
+      _mm_storeu_si128((__m128i*)(lanes + 2), lanes_23);
+#else
+      for (; i + 32 <= size; i += 32)
+        {
+        for (int l = 0; l < 4; ++l)
+          lanes[l] = hash_round(lanes[l], read_uint64(data + i + l * 8));
+        }
+#endif
+      uint64_t h = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+      uint64_t g = rotate_left(lanes[0], 18) + rotate_left(lanes[1], 12) + rotate_left(lanes[2], 7) + rotate_left(lanes[3], 1);
+      h += (uint64_t)size;
+      g ^= (uint64_t)size * hash_prime_3;
+      for (; i + 8 <= size; i += 8)
+        {
+        uint64_t k = hash_round(0, read_uint64(data + i));
+        h = rotate_left(h ^ k, 27) * hash_prime_1 + hash_prime_3;
+        g = rotate_left(g ^ k, 31) * hash_prime_2 + hash_prime_1;
+        }
+      for (; i < size; ++i)
+        {
+        h = rotate_left(h ^ (data[i] * hash_prime_3), 11) * hash_prime_1;
+        g = rotate_left(g ^ (data[i] * hash_prime_1), 13) * hash_prime_2;
+        }
+      hash[0] = avalanche(h);
+      hash[1] = avalanche(g);
+      }
+
+    uint64_t hash_shape(int32_t type, int32_t w, int32_t h, int32_t format, int32_t usage_flags)
+      {
+      int32_t shape[5] = { type, w, h, format, usage_flags };
+      uint64_t hash[2];
+      hash_bytes((const uint8_t*)shape, sizeof(shape), 0, hash);
+      return hash[0];
+      }
+
+    // bytes of 8-bit data that add_texture reads for the format, 0 if it cannot fill the format from 8-bit data
+    int32_t get_texture_data_size(int32_t w, int32_t h, int32_t format)
+      {
+      switch (format)
+        {
+        case texture_format_rgba8:
+        case texture_format_bgra8:
+        case texture_format_rgba8ui:
+        case texture_format_rgba16:
+        case texture_format_rgba32f:
+          return w * h * 4;
+        case texture_format_r8ui:
+        case texture_format_r8i:
+          return w * h;
+        default:
+          return 0;
+        }
+      }
+
+    int32_t get_texture_gpu_size(int32_t w, int32_t h, int32_t format)
+      {
+      switch (format)
+        {
+        case texture_format_rgba32f: return w * h * 16;
+        case texture_format_rgba16: return w * h * 8;
+        case texture_format_r8ui:
+        case texture_format_r8i: return w * h;
+        default: return w * h * 4;
+        }
+      }
     }
 
-  render_context::render_context() : _initialized(false)
+  render_context::render_context() : _frame_index(0), _geometry_pool_version(0), _initialized(false)
     {
+    memset(&_statistics, 0, sizeof(render_statistics));
+    memset(&_frame_statistics, 0, sizeof(render_statistics));
     }
 
   void render_context::init()
@@ -49,8 +191,14 @@ namespace RenderDoos
       {
       _buffer_objects[i].type = 0;
       _buffer_objects[i].size = 0;
+      _buffer_objects[i].capacity = 0;
       _buffer_objects[i].raw = nullptr;
+      _buffer_objects[i].raw_size = 0;
       _buffer_objects[i].metal_buffer = 0;
+      _buffer_objects[i].flags = 0;
+      _buffer_objects[i].mapped = nullptr;
+      _buffer_objects[i].offset = 0;
+      _buffer_objects[i].arena = -1;
       }
     for (int i = 0; i < MAX_SHADER; ++i)
       {
@@ -87,11 +235,56 @@ namespace RenderDoos
       {
       _queries[i].mode = 0;
       }
+    for (int i = 0; i < MAX_READBACKS; ++i)
+      {
+      memset(&_readbacks[i], 0, sizeof(readback_handle));
+      }
+    for (int i = 0; i < MAX_SUBMESH; ++i)
+      {
+      _submeshes[i].geometry = -1;
+      }
+    for (int i = 0; i <= VERTEX_COLOR_QUANTIZED; ++i)
+      {
+      _vertex_pools[i].buffer = -1;
+      _vertex_pools[i].allocator.init(0);
+      }
+    for (int i = 0; i < 2; ++i)
+      {
+      _index_pools[i].buffer = -1;
+      _index_pools[i].allocator.init(0);
+      }
+    for (int i = 0; i < MAX_BUFFER_ARENA; ++i)
+      {
+      _buffer_arenas[i].buffer = -1;
+      _buffer_arenas[i].allocator.init(0);
+      }
+    for (int i = 0; i <= VERTEX_COLOR_QUANTIZED; ++i)
+      {
+      geometry_handle* gh = &_transient_handles[i];
+      memset(gh, 0, sizeof(*gh));
+      gh->mode = GEOMETRY_ALLOCATED;
+      gh->vertex_declaration_type = i;
+      gh->vertex_size = _get_vertex_size(i);
+      gh->vertex.buffer = -1;
+      gh->index.buffer = -1;
+      gh->instance_buffer = -1;
+      gh->flags = GEOMETRY_STREAMING;
+      gh->quantization_extent[0] = gh->quantization_extent[1] = gh->quantization_extent[2] = 1.f;
+      }
+    _storage_offset_alignment = 0;
+    _transient_arena = -1;
+    _transient_cursor = 0;
+    _transient_required = 0;
+    _transient_frame = 0;
+    _transient_memory = nullptr;
     _initialized = true;
     }
 
   void render_context::destroy()
     {
+    _deferred_removals.clear(); // everything is removed below
+    _shared_resources.clear();
+    _statistics.shared_memory_saved = 0;
     for (int i = 0; i < MAX_TEXTURE; ++i)
       {
       remove_texture(i);
@@ -128,9 +321,888 @@ namespace RenderDoos
       {
       remove_query(i);
       }
+    for (int i = 0; i <= VERTEX_COLOR_QUANTIZED; ++i)
+      {
+      _vertex_pools[i].buffer = -1;
+      _vertex_pools[i].allocator.init(0);
+      }
+    for (int i = 0; i < 2; ++i)
+      {
+      _index_pools[i].buffer = -1;
+      _index_pools[i].allocator.init(0);
+      }
+    for (int i = 0; i < MAX_BUFFER_ARENA; ++i)
+      {
+      _buffer_arenas[i].buffer = -1;
+      _buffer_arenas[i].allocator.init(0);
+      }
+    _deferred_ranges.clear();
+    _transient_arena = -1;
     _initialized = false;
     }
 
+  void render_context::set_geometry_quantization(int32_t handle, const float4& bb_min, const float4& bb_max)
+    {
+    if (handle < 0 || handle >= MAX_GEOMETRY)
+      return;
+    geometry_handle* gh = &_geometry_handles[handle];
+    if (gh->mode == 0)
+      return;
+    for (int i = 0; i < 3; ++i)
+      {
+      gh->quantization_offset[i] = bb_min[i];
+      gh->quantization_extent[i] = bb_max[i] - bb_min[i];
+      }
+    }
+
+  void render_context::set_geometry_instances(int32_t handle, int32_t buffer_handle, int32_t instance_layout)
+    {
+    if (handle < 0 || handle >= MAX_GEOMETRY)
+      return;
+    geometry_handle* gh = &_geometry_handles[handle];
+    if (gh->mode == 0)
+      return;
+    if (instance_layout < INSTANCE_MATRIX || instance_layout > INSTANCE_MATRIX_DATA)
+      return;
+    gh->instance_buffer = buffer_handle >= 0 && buffer_handle < MAX_BUFFER_OBJECT ? buffer_handle : -1;
+    gh->instance_layout = instance_layout;
+    }
+
+  bool render_context::set_geometry_buffers(int32_t handle, int32_t vertex_buffer_handle, int32_t number_of_vertices, int32_t index_buffer_handle, int32_t number_of_indices)
+    {
+    if (handle < 0 || handle >= MAX_GEOMETRY)
+      return false;
+    geometry_handle* gh = &_geometry_handles[handle];
+    if (gh->mode == 0 || gh->locked)
+      return false;
+    if (!(gh->flags & GEOMETRY_EXTERNAL_BUFFERS) && (gh->vertex.buffer >= 0 || gh->index.buffer >= 0 || (gh->flags & (GEOMETRY_STREAMING | GEOMETRY_ZERO_COPY | GEOMETRY_POOLED))))
+      return false; // the geometry owns buffers already
+    if (vertex_buffer_handle < 0 || vertex_buffer_handle >= MAX_BUFFER_OBJECT || index_buffer_handle < 0 || index_buffer_handle >= MAX_BUFFER_OBJECT)
+      return false;
+    const buffer_object* vertices = &_buffer_objects[vertex_buffer_handle];
+    const buffer_object* indices = &_buffer_objects[index_buffer_handle];
+    if (vertices->type != COMPUTE_BUFFER || indices->type != COMPUTE_BUFFER || vertices->size == 0 || indices->size == 0)
+      return false;
+    if (indices->flags & (BUFFER_STREAMING | BUFFER_SUBALLOCATED)) // indirect draws address the index buffer from offset 0
+      return false;
+    if (number_of_vertices < 0)
+      number_of_vertices = vertices->size / gh->vertex_size;
+    if (number_of_indices < 0)
+      number_of_indices = indices->size / gh->index_size;
+    if (number_of_vertices * gh->vertex_size > vertices->size || number_of_indices * gh->index_size > indices->size)
+      return false;
+    memset(&gh->vertex, 0, sizeof(geometry_ref));
+    memset(&gh->index, 0, sizeof(geometry_ref));
+    gh->vertex.buffer = vertex_buffer_handle;
+    gh->vertex.count = number_of_vertices;
+    gh->index.buffer = index_buffer_handle;
+    gh->index.count = number_of_indices;
+    gh->flags |= GEOMETRY_EXTERNAL_BUFFERS;
+    return true;
+    }
+
+  int32_t render_context::_get_instance_size(int32_t instance_layout) const
+    {
+    switch (instance_layout)
+      {
+      case INSTANCE_MATRIX_COLOR: return sizeof(instance_matrix_color);
+      case INSTANCE_MATRIX_DATA: return sizeof(instance_matrix_data);
+      default: return sizeof(float4x4);
+      }
+    }
+
+  int32_t render_context::add_submesh(int32_t geometry_handle, int32_t first_index, int32_t index_count, int32_t base_vertex)
+    {
+    if (geometry_handle < 0 || geometry_handle >= MAX_GEOMETRY || _geometry_handles[geometry_handle].mode == 0)
+      return -1;
+    if (first_index < 0 || index_count < 0)
+      return -1;
+    submesh* sm = _submeshes;
+    for (int32_t i = 0; i < MAX_SUBMESH; ++i)
+      {
+      if (sm->geometry < 0)
+        {
+        sm->geometry = geometry_handle;
+        sm->first_index = first_index;
+        sm->index_count = index_count;
+        sm->base_vertex = base_vertex;
+        return i;
+        }
+      ++sm;
+      }
+    return -1;
+    }
+
+  void render_context::remove_submesh(int32_t handle)
+    {
+    if (handle < 0 || handle >= MAX_SUBMESH)
+      return;
+    _submeshes[handle].geometry = -1;
+    }
+
+  const geometry_handle* render_context::get_geometry(int32_t handle) const
+    {
+    if (handle < 0 || handle >= MAX_GEOMETRY || _geometry_handles[handle].mode == 0)
+      return nullptr;
+    return &_geometry_handles[handle];
+    }
+
+  const submesh* render_context::get_submesh(int32_t handle) const
+    {
+    if (handle < 0 || handle >= MAX_SUBMESH || _submeshes[handle].geometry < 0)
+      return nullptr;
+    return &_submeshes[handle];
+    }
+
+  void render_context::submesh_draw(int32_t handle, int32_t instance_count)
+    {
+    if (handle < 0 || handle >= MAX_SUBMESH)
+      return;
+    const submesh* sm = &_submeshes[handle];
+    if (sm->geometry < 0)
+      return;
+    int32_t first_index = sm->first_index;
+    int32_t index_count = sm->index_count;
+    if (!_clip_index_range(&_geometry_handles[sm->geometry], first_index, index_count)) // the geometry may have been refilled with fewer indices
+      return;
+    _geometry_draw(sm->geometry, first_index, index_count, sm->base_vertex, instance_count);
+    }
+
+  void render_context::record_batching(int32_t number_of_items, int32_t number_of_draws)
+    {
+    _statistics.batched_items += number_of_items;
+    _statistics.batched_draws += number_of_draws;
+    }
+
+  void render_context::record_pool_request(bool hit)
+    {
+    if (hit)
+      ++_statistics.pool_hits;
+    else
+      ++_statistics.pool_misses;
+    }
+
+  bool render_context::get_draw_indirect_command(const draw_command& command, draw_indirect_command& indirect) const
+    {
+    if (command.geometry < 0 || command.geometry >= MAX_GEOMETRY)
+      return false;
+    const geometry_handle* gh = &_geometry_handles[command.geometry];
+    if (gh->flags & GEOMETRY_STREAMING)
+      return false;
+    int32_t first_index = command.first_index;
+    int32_t index_count = command.index_count;
+    if (!_clip_index_range(gh, first_index, index_count))
+      return false;
+    indirect.index_count = (uint32_t)index_count;
+    indirect.instance_count = (uint32_t)(command.instance_count < 1 ? 1 : command.instance_count);
+    indirect.first_index = (uint32_t)(gh->index.offset + first_index);
+    indirect.base_vertex = gh->vertex.offset + command.base_vertex;
+    indirect.base_instance = (uint32_t)command.base_instance;
+    return true;
+    }
+
+  bool render_context::transient_geometry_begin(transient_geometry& tg, int32_t vertex_declaration_type, int32_t number_of_vertices, int32_t number_of_indices, float** vertex_pointer, void** index_pointer, int32_t index_type)
+    {
+    if (vertex_declaration_type < VERTEX_STANDARD || vertex_declaration_type > VERTEX_COLOR_QUANTIZED || number_of_vertices < 0 || number_of_indices < 0)
+      return false;
+    if (_transient_arena < 0 || _transient_frame != _frame_index) // first allocation of this frame
+      {
+      int32_t size = _transient_arena < 0 ? 0 : _buffer_objects[_transient_arena].size;
+      if (_transient_arena < 0 || _transient_required > size)
+        {
+        // the frames in flight keep using the old buffer until the gpu is done with it
+        size = std::max<int32_t>(std::max<int32_t>(size * 2, _transient_required), TRANSIENT_ARENA_INITIAL_SIZE);
+        if (_transient_arena >= 0)
+          remove_deferred(RESOURCE_BUFFER_OBJECT, _transient_arena);
+        _transient_arena = add_buffer_object(nullptr, size, COMPUTE_BUFFER | BUFFER_STREAMING);
+        if (_transient_arena < 0)
+          return false;
+        }
+      _transient_frame = _frame_index;
+      _transient_cursor = 0;
+      _transient_required = 0;
+      _transient_memory = _streaming_partition(&_buffer_objects[_transient_arena]);
+      }
+    int32_t vertex_size = _get_vertex_size(vertex_declaration_type);
+    int32_t index_size = index_type == INDEX_TYPE_16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    // vertices start at a multiple of their size, so that the vertex offset is a base vertex
+    int32_t vertex_start = (_transient_cursor + vertex_size - 1) / vertex_size * vertex_size;
+    int32_t index_start = (vertex_start + number_of_vertices * vertex_size + 3) & ~3;
+    int32_t end = index_start + number_of_indices * index_size;
+    _transient_required += end - _transient_cursor;
+    if (end > _buffer_objects[_transient_arena].size)
+      return false;
+    _transient_cursor = end;
+    tg.vertex_declaration_type = vertex_declaration_type;
+    tg.index_size = index_size;
+    tg.vertex_offset = vertex_start / vertex_size;
+    tg.index_offset = index_start / index_size;
+    tg.number_of_indices = number_of_indices;
+    tg.frame = _frame_index;
+    if (vertex_pointer)
+      *vertex_pointer = (float*)(_transient_memory + vertex_start);
+    if (index_pointer)
+      *index_pointer = (void*)(_transient_memory + index_start);
+    _statistics.bytes_uploaded += end - vertex_start;
+    return true;
+    }
+
+  geometry_handle* render_context::_get_transient_handle(const transient_geometry& tg)
+    {
+    if (_transient_arena < 0 || tg.frame != _frame_index || tg.vertex_declaration_type < VERTEX_STANDARD || tg.vertex_declaration_type > VERTEX_COLOR_QUANTIZED)
+      return nullptr;
+    geometry_handle* gh = &_transient_handles[tg.vertex_declaration_type];
+    gh->vertex.buffer = _transient_arena;
+    gh->vertex.offset = tg.vertex_offset;
+    gh->index.buffer = _transient_arena;
+    gh->index.offset = tg.index_offset;
+    gh->index.count = tg.number_of_indices;
+    gh->index_size = tg.index_size;
+    return gh;
+    }
+
+  int32_t render_context::_get_vertex_size(int32_t vertex_declaration_type) const
+    {
+    switch (vertex_declaration_type)
+      {
+      case VERTEX_COMPACT: return sizeof(vertex_compact);
+      case VERTEX_COLOR: return sizeof(vertex_color);
+      case VERTEX_2_2_3: return 7 * sizeof(float);
+      case VERTEX_STANDARD_QUANTIZED: return sizeof(vertex_standard_quantized);
+      case VERTEX_COMPACT_QUANTIZED: return sizeof(vertex_compact_quantized);
+      case VERTEX_COLOR_QUANTIZED: return sizeof(vertex_color_quantized);
+      default: return sizeof(vertex_standard);
+      }
+    }
+
+  bool render_context::_clip_index_range(const geometry_handle* gh, int32_t& first_index, int32_t& index_count) const
+    {
+    if (gh->mode == 0 || first_index < 0 || first_index >= gh->index.count)
+      return false;
+    if (index_count < 0 || first_index + index_count > gh->index.count)
+      index_count = gh->index.count - first_index;
+    return index_count > 0;
+    }
+
+  void render_context::_remove_submeshes(int32_t geometry_handle)
+    {
+    for (int32_t i = 0; i < MAX_SUBMESH; ++i)
+      {
+      if (_submeshes[i].geometry == geometry_handle)
+        _submeshes[i].geometry = -1;
+      }
+    }
+
+  int32_t render_context::_get_index_size(const geometry_handle* gh, int32_t number_of_vertices) const
+    {
+    switch (gh->index_type)
+      {
+      case INDEX_TYPE_16: return sizeof(uint16_t);
+      case INDEX_TYPE_32: return sizeof(uint32_t);
+      default: return number_of_vertices <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+      }
+    }
+
+  void render_context::_narrow_indices(geometry_handle* gh, uint8_t* destination, const uint8_t* source)
+    {
+    if (gh->index_type != INDEX_TYPE_AUTO || gh->index_size != sizeof(uint16_t) || gh->index.buffer < 0)
+      return;
+    uint8_t* raw = _buffer_objects[gh->index.buffer].raw;
+    if (gh->index_staging) // pooled geometry: from the staging block into the range of the pool
+      {
+      source = gh->index_staging;
+      destination = raw + gh->index.offset * sizeof(uint16_t);
+      }
+    uint16_t* out = (uint16_t*)(destination ? destination : raw);
+    const uint32_t* in = (const uint32_t*)(source ? source : raw);
+    if (destination && gh->index.number_of_dirty_ranges > 0) // a separate staging block only holds the rewritten ranges, the destination keeps the others
+      {
+      for (int32_t i = 0; i < gh->index.number_of_dirty_ranges; ++i)
+        {
+        int32_t first = std::max(gh->index.dirty_ranges[i].offset, 0) / 4;
+        int32_t last = std::min((gh->index.dirty_ranges[i].offset + gh->index.dirty_ranges[i].size + 3) / 4, gh->index.count);
+        if (first < last)
+          narrow_indices(out + first, in + first, last - first);
+        }
+      }
+    else
+      narrow_indices(out, in, gh->index.count);
+    for (int32_t i = 0; i < gh->index.number_of_dirty_ranges; ++i) // the ranges were given for the 32-bit indices
+      {
+      int32_t first = gh->index.dirty_ranges[i].offset / 4;
+      int32_t last = (gh->index.dirty_ranges[i].offset + gh->index.dirty_ranges[i].size + 3) / 4;
+      gh->index.dirty_ranges[i].offset = first * 2;
+      gh->index.dirty_ranges[i].size = (last - first) * 2;
+      }
+    if (gh->index_staging)
+      {
+      delete[] gh->index_staging;
+      gh->index_staging = nullptr;
+      _statistics.host_memory -= gh->index.count * sizeof(uint32_t);
+      }
+    }
+
+  void render_context::geometry_dirty_range(int32_t handle, int32_t update, int32_t offset, int32_t size)
+    {
+    if (handle < 0 || handle >= MAX_GEOMETRY)
+      return;
+    geometry_handle* gh = &_geometry_handles[handle];
+    if (gh->mode == 0)
+      return;
+    if ((update & GEOMETRY_VERTEX) && (gh->locked & GEOMETRY_VERTEX))
+      _add_dirty_range(gh->vertex, offset, size);
+    if ((update & GEOMETRY_INDEX) && (gh->locked & GEOMETRY_INDEX))
+      _add_dirty_range(gh->index, offset, size);
+    }
+
+  void render_context::_add_dirty_range(geometry_ref& ref, int32_t offset, int32_t size)
+    {
+    if (ref.number_of_dirty_ranges < 0 || size <= 0)
+      return;
+    int32_t first = offset;
+    int32_t last = offset + size;
+    dirty_range merged[MAX_DIRTY_RANGES + 1];
+    int32_t n = 0;
+    bool inserted = false;
+    for (int32_t i = 0; i < ref.number_of_dirty_ranges; ++i)
+      {
+      const dirty_range& r = ref.dirty_ranges[i];
+      if (r.offset + r.size < first)
+        merged[n++] = r;
+      else if (r.offset > last)
+        {
+        if (!inserted)
+          {
+          merged[n].offset = first;
+          merged[n++].size = last - first;
+          inserted = true;
+          }
+        merged[n++] = r;
+        }
+      else // overlapping or touching
+        {
+        first = r.offset < first ? r.offset : first;
+        last = r.offset + r.size > last ? r.offset + r.size : last;
+        }
+      }
+    if (!inserted)
+      {
+      merged[n].offset = first;
+      merged[n++].size = last - first;
+      }
+    if (n > MAX_DIRTY_RANGES) // no room left, join the two ranges with the smallest gap
+      {
+      int32_t best = 0;
+      for (int32_t i = 1; i + 1 < n; ++i)
+        {
+        if (merged[i + 1].offset - (merged[i].offset + merged[i].size) < merged[best + 1].offset - (merged[best].offset + merged[best].size))
+          best = i;
+        }
+      merged[best].size = merged[best + 1].offset + merged[best + 1].size - merged[best].offset;
+      for (int32_t i = best + 1; i + 1 < n; ++i)
+        merged[i] = merged[i + 1];
+      --n;
+      }
+    memcpy(ref.dirty_ranges, merged, n * sizeof(dirty_range));
+    ref.number_of_dirty_ranges = n;
+    }
+
+  void render_context::_finish_frame_statistics()
+    {
+    _frame_statistics = _statistics;
+    uint64_t host_memory = _statistics.host_memory; // not a per frame counter
+    memset(&_statistics, 0, sizeof(render_statistics));
+    _statistics.host_memory = host_memory;
+    _statistics.shared_memory_saved = _frame_statistics.shared_memory_saved;
+    }
+
+  uint8_t* render_context::_allocate_host_memory(buffer_object* buf, int32_t size)
+    {
+    _free_host_memory(buf);
+    buf->raw = new uint8_t[size];
+    buf->raw_size = size;
+    _statistics.host_memory += size;
+    return buf->raw;
+    }
+
+  void render_context::_free_host_memory(buffer_object* buf)
+    {
+    if (buf->raw)
+      {
+      delete[] buf->raw;
+      _statistics.host_memory -= buf->raw_size;
+      }
+    buf->raw = nullptr;
+    buf->raw_size = 0;
+    }
+
+  void render_context::_grow_host_memory(buffer_object* buf, int32_t size)
+    {
+    uint8_t* raw = new uint8_t[size];
+    if (buf->raw)
+      memcpy(raw, buf->raw, buf->raw_size < size ? buf->raw_size : size);
+    _free_host_memory(buf);
+    buf->raw = raw;
+    buf->raw_size = size;
+    _statistics.host_memory += size;
+    }
+
+  geometry_pool* render_context::_get_geometry_pool(const geometry_handle* gh, int32_t type)
+    {
+    geometry_pool* pool = type == GEOMETRY_VERTEX ? &_vertex_pools[gh->vertex_declaration_type] : &_index_pools[gh->index_size == sizeof(uint16_t) ? 0 : 1];
+    pool->element_size = type == GEOMETRY_VERTEX ? gh->vertex_size : gh->index_size;
+    return pool;
+    }
+
+  uint8_t* render_context::_allocate_pooled(geometry_ref& ref, geometry_pool* pool, int32_t count, int32_t type)
+    {
+    uint32_t elements = _get_pool_elements(pool, count);
+    if (ref.buffer >= 0 && (ref.buffer != pool->buffer || pool->allocator.get_allocation_size(ref.offset) < elements))
+      _release_pooled(ref); // the geometry moved to another pool or outgrew its range, the old data is not kept
+    if (ref.buffer < 0)
+      {
+      uint32_t offset = pool->buffer < 0 ? OFFSET_ALLOCATOR_INVALID : pool->allocator.allocate(elements);
+      if (offset == OFFSET_ALLOCATOR_INVALID)
+        {
+        if (pool->buffer < 0) // first geometry in this pool
+          {
+          buffer_object* buf = _buffer_objects;
+          for (int32_t i = 0; i < MAX_BUFFER_OBJECT; ++i)
+            {
+            if (buf->size == 0)
+              {
+              pool->buffer = i;
+              break;
+              }
+            ++buf;
+            }
+          if (pool->buffer < 0) // all buffers are used
+            throw std::runtime_error("Out of memory");
+          buf->type = type;
+          buf->flags = BUFFER_POOLED;
+          pool->allocator.init(0);
+          }
+        buffer_object* buf = &_buffer_objects[pool->buffer];
+        uint32_t old_size = pool->allocator.get_size();
+        uint32_t new_size = old_size * 2;
+        if (new_size < (uint32_t)(GEOMETRY_POOL_INITIAL_SIZE / pool->element_size))
+          new_size = (uint32_t)(GEOMETRY_POOL_INITIAL_SIZE / pool->element_size);
+        if (new_size < old_size + elements)
+          new_size = old_size + elements;
+        _grow_host_memory(buf, (int32_t)(new_size * pool->element_size));
+        _update_geometry_pool(buf, (int32_t)(old_size * pool->element_size));
+        pool->allocator.grow(new_size);
+        offset = pool->allocator.allocate(elements);
+        }
+      ref.buffer = pool->buffer;
+      ref.offset = (int32_t)offset;
+      ref.number_of_dirty_ranges = -1; // new range, everything has to be sent
+      ++_geometry_pool_version;
+      }
+    else
+      ref.number_of_dirty_ranges = 0;
+    ref.count = count;
+    return _buffer_objects[ref.buffer].raw + ref.offset * pool->element_size;
+    }
+
+  uint32_t render_context::_get_pool_elements(const geometry_pool* pool, int32_t count) const
+    {
+    uint32_t elements = count > 0 ? (uint32_t)count : 1;
+    if (pool->element_size == sizeof(uint16_t)) // even sizes keep the ranges of 16-bit indices 4-byte aligned, as metal wants index buffer offsets
+      elements = (elements + 1) & ~1u;
+    return elements;
+    }
+
+  void render_context::_release_pooled(geometry_ref& ref)
+    {
+    if (ref.buffer < 0)
+      return;
+    // the range is reused once the gpu finished the frames in flight
+    for (int i = 0; i <= VERTEX_COLOR_QUANTIZED; ++i)
+      {
+      if (_vertex_pools[i].buffer == ref.buffer)
+        _defer_range(&_vertex_pools[i].allocator, (uint32_t)ref.offset);
+      }
+    for (int i = 0; i < 2; ++i)
+      {
+      if (_index_pools[i].buffer == ref.buffer)
+        _defer_range(&_index_pools[i].allocator, (uint32_t)ref.offset);
+      }
+    ref.buffer = -1;
+    ref.offset = 0;
+    ref.count = 0;
+    }
+
+  void render_context::defragment_geometry_pools()
+    {
+    geometry_pool* pools[VERTEX_COLOR_QUANTIZED + 1 + 2];
+    int32_t number_of_pools = 0;
+    for (int i = 0; i <= VERTEX_COLOR_QUANTIZED; ++i)
+      pools[number_of_pools++] = &_vertex_pools[i];
+    for (int i = 0; i < 2; ++i)
+      pools[number_of_pools++] = &_index_pools[i];
+    geometry_ref* refs[MAX_GEOMETRY];
+    for (int32_t p = 0; p < number_of_pools; ++p)
+      {
+      geometry_pool* pool = pools[p];
+      if (pool->buffer < 0 || pool->allocator.get_largest_free_range() == pool->allocator.get_size() - pool->allocator.get_used())
+        continue; // unused or already compact
+      int32_t number_of_refs = 0;
+      bool locked = false;
+      for (int32_t i = 0; i < MAX_GEOMETRY; ++i)
+        {
+        geometry_handle* gh = &_geometry_handles[i];
+        if (gh->mode == 0 || !(gh->flags & GEOMETRY_POOLED))
+          continue;
+        if (gh->vertex.buffer == pool->buffer)
+          {
+          refs[number_of_refs++] = &gh->vertex;
+          locked |= (gh->locked & GEOMETRY_VERTEX) != 0;
+          }
+        if (gh->index.buffer == pool->buffer)
+          {
+          refs[number_of_refs++] = &gh->index;
+          locked |= (gh->locked & GEOMETRY_INDEX) != 0;
+          }
+        }
+      if (locked)
+        continue;
+      std::sort(refs, refs + number_of_refs, [](const geometry_ref* left, const geometry_ref* right) { return left->offset < right->offset; });
+      buffer_object* buf = &_buffer_objects[pool->buffer];
+      // the released ranges are compacted away with the rest of the free space
+      _deferred_ranges.erase(std::remove_if(_deferred_ranges.begin(), _deferred_ranges.end(), [pool](const deferred_range& range) { return range.allocator == &pool->allocator; }), _deferred_ranges.end());
+      pool->allocator.init(pool->allocator.get_size());
+      for (int32_t i = 0; i < number_of_refs; ++i) // the pool has a single free range, so the ranges are placed one after the other
+        {
+        uint32_t offset = pool->allocator.allocate(_get_pool_elements(pool, refs[i]->count));
+        memmove(buf->raw + offset * pool->element_size, buf->raw + refs[i]->offset * pool->element_size, refs[i]->count * pool->element_size);
+        refs[i]->offset = (int32_t)offset;
+        }
+      _update_geometry_pool(buf, (int32_t)(pool->allocator.get_used() * pool->element_size));
+      ++_geometry_pool_version;
+      }
+    }
+
+  uint8_t* render_context::_streaming_partition(buffer_object* buf)
+    {
+    buf->partition = (int32_t)(_frame_index % MAX_FRAMES_IN_FLIGHT);
+    return buf->mapped + buf->partition * buf->stride;
+    }
+
+  void render_context::_check_streaming_write(const buffer_object* buf, int32_t offset, int32_t size) const
+    {
+    // the other partitions hold older frames, so bytes that are skipped or rewritten in a frame would be stale or
+    // would change under the earlier draws of the frame
+    int32_t written = buf->written_frame == _frame_index ? buf->written : 0;
+    if (offset != written || (offset > 0 && offset + size > buf->size))
+      throw std::runtime_error("Streaming buffers are written once per frame, front to back");
+    }
+
+  void render_context::remove_deferred(int32_t resource_type, int32_t handle)
+    {
+    if (handle < 0)
+      return;
+    for (const auto& removal : _deferred_removals)
+      {
+      if (removal.type == resource_type && removal.handle == handle) // removing twice could hit a reused handle later
+        return;
+      }
+    deferred_removal removal;
+    removal.type = resource_type;
+    removal.handle = handle;
+    removal.frame = _frame_index;
+    _deferred_removals.push_back(removal);
+    }
+
+  void render_context::flush_deferred_removals()
+    {
+    for (const auto& removal : _deferred_removals)
+      _remove_resource(removal.type, removal.handle);
+    _deferred_removals.clear();
+    _free_deferred_ranges(true);
+    }
+
+  void render_context::_release_deferred_removals()
+    {
+    // frame_begin of frame f runs after the gpu finished frame f - MAX_FRAMES_IN_FLIGHT
+    size_t released = 0;
+    while (released < _deferred_removals.size() && _deferred_removals[released].frame + MAX_FRAMES_IN_FLIGHT <= _frame_index)
+      {
+      _remove_resource(_deferred_removals[released].type, _deferred_removals[released].handle);
+      ++released;
+      }
+    _deferred_removals.erase(_deferred_removals.begin(), _deferred_removals.begin() + released);
+    _free_deferred_ranges(false);
+    }
+
+  void render_context::_remove_resource(int32_t resource_type, int32_t handle)
+    {
+    switch (resource_type)
+      {
+      case RESOURCE_TEXTURE:
+        remove_texture(handle);
+        break;
+      case RESOURCE_GEOMETRY:
+        remove_geometry(handle);
+        break;
+      case RESOURCE_BUFFER_OBJECT:
+        remove_buffer_object(handle);
+        break;
+      case RESOURCE_FRAME_BUFFER:
+        remove_frame_buffer(handle);
+        break;
+      default:
+        break;
+      }
+    }
+
+  int32_t render_context::_partition_offset(const buffer_object* buf) const
+    {
+    if (buf->flags & BUFFER_STREAMING)
+      return buf->partition * buf->stride;
+    if (buf->flags & BUFFER_SUBALLOCATED)
+      return buf->offset;
+    return 0;
+    }
+
+  bool render_context::_suballocate(buffer_object* buf, int32_t size)
+    {
+    if (size > BUFFER_SUBALLOCATION_MAX_SIZE)
+      return false;
+    if (_storage_offset_alignment == 0)
+      _storage_offset_alignment = std::max<int32_t>(_get_storage_offset_alignment(), 4);
+    uint32_t units = (uint32_t)((std::max<int32_t>(size, 1) + _storage_offset_alignment - 1) / _storage_offset_alignment);
+    for (int i = 0; i < MAX_BUFFER_ARENA; ++i)
+      {
+      buffer_arena* arena = &_buffer_arenas[i];
+      if (arena->buffer < 0) // arenas are filled in order, so this one is new
+        {
+        arena->buffer = add_buffer_object(nullptr, BUFFER_ARENA_SIZE, COMPUTE_BUFFER);
+        if (arena->buffer < 0)
+          return false;
+        arena->allocator.init(BUFFER_ARENA_SIZE / _storage_offset_alignment);
+        }
+      uint32_t offset = arena->allocator.allocate(units);
+      if (offset == OFFSET_ALLOCATOR_INVALID)
+        continue;
+      const buffer_object* storage = &_buffer_objects[arena->buffer];
+      buf->gl_buffer_id = storage->gl_buffer_id;
+      buf->metal_buffer = storage->metal_buffer;
+      buf->offset = (int32_t)offset * _storage_offset_alignment;
+      buf->capacity = (int32_t)units * _storage_offset_alignment;
+      buf->arena = i;
+      buf->flags |= BUFFER_SUBALLOCATED;
+      return true;
+      }
+    return false;
+    }
+
+  void render_context::_release_suballocated(const buffer_object* buf)
+    {
+    if (buf->arena >= 0 && buf->arena < MAX_BUFFER_ARENA && _buffer_arenas[buf->arena].buffer >= 0)
+      _defer_range(&_buffer_arenas[buf->arena].allocator, (uint32_t)(buf->offset / _storage_offset_alignment));
+    }
+
+  void render_context::_defer_range(offset_allocator* allocator, uint32_t offset)
+    {
+    deferred_range range;
+    range.allocator = allocator;
+    range.offset = offset;
+    range.frame = _frame_index;
+    _deferred_ranges.push_back(range);
+    }
+
+  void render_context::_free_deferred_ranges(bool all)
+    {
+    size_t released = 0;
+    while (released < _deferred_ranges.size() && (all || _deferred_ranges[released].frame + MAX_FRAMES_IN_FLIGHT <= _frame_index))
+      {
+      _deferred_ranges[released].allocator->free(_deferred_ranges[released].offset);
+      ++released;
+      }
+    _deferred_ranges.erase(_deferred_ranges.begin(), _deferred_ranges.begin() + released);
+    }
+
+  int32_t render_context::add_buffer_object_from_file(const char* filename, int64_t offset, int64_t size, int32_t buffer_type, double* megabytes_per_second)
+    {
+    auto start = std::chrono::steady_clock::now();
+    mapped_file file;
+    if (!file.open(filename) || offset < 0 || (uint64_t)offset >= file.size())
+      return -1;
+    int64_t available = (int64_t)(file.size() - (uint64_t)offset);
+    if (size < 0 || size > available)
+      size = available;
+    if (size == 0 || size > INT32_MAX)
+      return -1;
+    int32_t handle = add_buffer_object(nullptr, (int32_t)size, buffer_type);
+    if (handle < 0)
+      return -1;
+    // the pages are read while touched by the upload, so ask for the next chunk before uploading the current one
+    file.prefetch((uint64_t)offset, (uint64_t)std::min<int64_t>(size, FILE_STAGING_CHUNK_SIZE));
+    for (int64_t done = 0; done < size; done += FILE_STAGING_CHUNK_SIZE)
+      {
+      int32_t chunk = (int32_t)std::min<int64_t>(size - done, FILE_STAGING_CHUNK_SIZE);
+      if (done + chunk < size)
+        file.prefetch((uint64_t)(offset + done + chunk), (uint64_t)std::min<int64_t>(size - done - chunk, FILE_STAGING_CHUNK_SIZE));
+      _stage_buffer_object_data(handle, file.data() + offset + done, chunk, (int32_t)done);
+      }
+    _finish_staging();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    _statistics.file_bytes_read += (uint64_t)size;
+    _statistics.file_read_seconds += seconds;
+    if (megabytes_per_second)
+      *megabytes_per_second = seconds > 0.0 ? (double)size / seconds / 1e6 : 0.0;
+    return handle;
+    }
+
+  int32_t render_context::_find_shared(const uint64_t hash[2], int32_t type, int32_t w, int32_t h, int32_t format, int32_t usage_flags) const
+    {
+    for (int32_t i = 0; i < (int32_t)_shared_resources.size(); ++i)
+      {
+      const shared_resource& res = _shared_resources[i];
+      if (res.hash[0] != hash[0] || res.hash[1] != hash[1] || res.type != type)
+        continue;
+      // the hash includes the shape, comparing it as well rules out collisions between shapes
+      if (type == RESOURCE_TEXTURE)
+        {
+        const texture* tex = get_texture(res.handle);
+        if (tex->w == w && tex->h == h && tex->format == format && tex->usage_flags == usage_flags)
+          return i;
+        }
+      else
+        {
+        const buffer_object* buf = get_buffer_object(res.handle);
+        if (buf->size == w && buf->type == (format & BUFFER_TYPE_MASK))
+          return i;
+        }
+      }
+    return -1;
+    }
+
+  int32_t render_context::add_texture_shared(int32_t w, int32_t h, int32_t format, const uint8_t* data, int32_t usage_flags)
+    {
+    int32_t data_size = get_texture_data_size(w, h, format);
+    if (data == nullptr || data_size <= 0)
+      return add_texture(w, h, format, data, usage_flags);
+    uint64_t hash[2];
+    hash_bytes(data, (size_t)data_size, hash_shape(RESOURCE_TEXTURE, w, h, format, usage_flags), hash);
+    int32_t index = _find_shared(hash, RESOURCE_TEXTURE, w, h, format, usage_flags);
+    if (index >= 0)
+      {
+      shared_resource& res = _shared_resources[index];
+      ++res.references;
+      _statistics.shared_memory_saved += (uint64_t)res.gpu_size;
+      return res.handle;
+      }
+    int32_t handle = add_texture(w, h, format, data, usage_flags);
+    if (handle < 0)
+      return -1;
+    shared_resource res;
+    res.hash[0] = hash[0];
+    res.hash[1] = hash[1];
+    res.type = RESOURCE_TEXTURE;
+    res.handle = handle;
+    res.references = 1;
+    res.gpu_size = get_texture_gpu_size(w, h, format);
+    _shared_resources.push_back(res);
+    return handle;
+    }
+
+  int32_t render_context::add_buffer_object_shared(const void* data, int32_t size, int32_t buffer_type)
+    {
+    if (data == nullptr || size <= 0 || (buffer_type & BUFFER_STREAMING))
+      return add_buffer_object(data, size, buffer_type);
+    uint64_t hash[2];
+    hash_bytes((const uint8_t*)data, (size_t)size, hash_shape(RESOURCE_BUFFER_OBJECT, size, 0, buffer_type, 0), hash);
+    int32_t index = _find_shared(hash, RESOURCE_BUFFER_OBJECT, size, 0, buffer_type, 0);
+    if (index >= 0)
+      {
+      shared_resource& res = _shared_resources[index];
+      ++res.references;
+      _statistics.shared_memory_saved += (uint64_t)res.gpu_size;
+      return res.handle;
+      }
+    int32_t handle = add_buffer_object(data, size, buffer_type);
+    if (handle < 0)
+      return -1;
+    shared_resource res;
+    res.hash[0] = hash[0];
+    res.hash[1] = hash[1];
+    res.type = RESOURCE_BUFFER_OBJECT;
+    res.handle = handle;
+    res.references = 1;
+    res.gpu_size = size;
+    _shared_resources.push_back(res);
+    return handle;
+    }
+
+  void render_context::_forget_shared(int32_t resource_type, int32_t handle)
+    {
+    for (size_t i = 0; i < _shared_resources.size(); ++i)
+      {
+      shared_resource& res = _shared_resources[i];
+      if (res.type != resource_type || res.handle != handle)
+        continue;
+      _statistics.shared_memory_saved -= (uint64_t)(res.references - 1) * (uint64_t)res.gpu_size;
+      _shared_resources[i] = _shared_resources.back();
+      _shared_resources.pop_back();
+      return;
+      }
+    }
+
+  void render_context::release_shared(int32_t resource_type, int32_t handle)
+    {
+    for (size_t i = 0; i < _shared_resources.size(); ++i)
+      {
+      shared_resource& res = _shared_resources[i];
+      if (res.type != resource_type || res.handle != handle)
+        continue;
+      if (--res.references > 0)
+        {
+        _statistics.shared_memory_saved -= (uint64_t)res.gpu_size;
+        return;
+        }
+      _shared_resources[i] = _shared_resources.back();
+      _shared_resources.pop_back();
+      break;
+      }
+    _remove_resource(resource_type, handle);
+    }
+
+  void render_context::_merge_copy_regions(const buffer_copy_region* regions, int32_t number_of_regions)
+    {
+    _copy_regions.clear();
+    for (int32_t i = 0; i < number_of_regions; ++i)
+      {
+      buffer_copy_region region = regions[i];
+      if (region.size == 0 || region.source < 0 || region.source >= MAX_BUFFER_OBJECT || region.destination < 0 || region.destination >= MAX_BUFFER_OBJECT)
+        continue;
+      const buffer_object* src = &_buffer_objects[region.source];
+      const buffer_object* dst = &_buffer_objects[region.destination];
+      if (src->size == 0 || dst->size == 0)
+        continue;
+      region.read_offset += _partition_offset(src);
+      region.write_offset += _partition_offset(dst);
+      if (src->flags & BUFFER_SUBALLOCATED) // buffers of the same arena share their storage
+        region.source = _buffer_arenas[src->arena].buffer;
+      if (dst->flags & BUFFER_SUBALLOCATED)
+        region.destination = _buffer_arenas[dst->arena].buffer;
+      if (!_copy_regions.empty()) // sorting would change the result of regions that overlap or read earlier writes
+        {
+        buffer_copy_region& last = _copy_regions.back();
+        uint32_t size = last.size + region.size;
+        bool overlap = last.source == last.destination && last.read_offset < last.write_offset + size && last.write_offset < last.read_offset + size; // a chain within one buffer
+        if (last.source == region.source && last.destination == region.destination && !overlap &&
+          last.read_offset + last.size == region.read_offset && last.write_offset + last.size == region.write_offset)
+          {
+          last.size += region.size;
+          continue;
+          }
+        }
+      _copy_regions.push_back(region);
+      }
+    }
+
   void render_context::remove_uniform(int32_t handle)
     {
     if (handle < 0 || handle >= MAX_UNIFORMS)
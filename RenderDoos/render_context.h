@@ -2,8 +2,10 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <vector>
 
 #include "float.h"
+#include "offset_allocator.h"
 
 namespace RenderDoos
   {
@@ -17,7 +19,12 @@ namespace RenderDoos
 #define MAX_RENDERBUFFER 1024
 #define MAX_UNIFORMS 1024
 #define MAX_QUERIES 16
+#define MAX_READBACKS 16
 #define MAX_TEXSTAGE  16
+#define MAX_FRAMES_IN_FLIGHT 3
+#define MAX_DIRTY_RANGES 16
+#define MAX_SUBMESH 8192
+#define MAX_BUFFER_ARENA 16
 
 #define TEX_ALLOCATED 1
 
@@ -38,12 +45,53 @@ namespace RenderDoos
 #define GEOMETRY_INDEX 2
 #define COMPUTE_BUFFER 3
 #define ATOMIC_COUNTER_BUFFER 4
+#define BUFFER_TYPE_MASK 0xff
+#define BUFFER_STREAMING 0x100 // or with the buffer type: persistently mapped ring with a partition per frame in flight. Write once per frame,
+                               // front to back: the first update of a frame starts at offset 0 and later updates of that frame append
+#define BUFFER_POOLED 0x200    // shared vertex or index buffer of a geometry pool
+#define BUFFER_SUBALLOCATED 0x400 // or with COMPUTE_BUFFER: small buffer placed in a range of a shared arena buffer
+
+#define GEOMETRY_STREAMING 1 // geometry flag: vertices and indices are written straight into a persistently mapped ring. Write once per frame,
+                             // a second geometry_begin in a frame overwrites the data that the earlier draws of that frame read
+#define GEOMETRY_ZERO_COPY 2 // geometry flag: geometry_begin maps the gpu buffers, no cpu copy of the data is kept. On metal the mapping is
+                             // the memory that in flight frames read, so only rewrite geometry that no unfinished frame draws
+#define GEOMETRY_POOLED 4    // geometry flag: vertices and indices are placed inside large buffers that are shared with other geometries. On metal
+                             // the updates made inside a render pass reach the gpu when the pass ends
+#define GEOMETRY_VERTEX_PULLING 8 // geometry flag: no vertex attributes, the vertex shader fetches vertices and indices from storage buffers (MATERIAL_VARIANT_VERTEX_PULLING)
+#define GEOMETRY_EXTERNAL_BUFFERS 16 // geometry flag, set by set_geometry_buffers: vertices and indices live in compute buffers that the geometry does not own
+
+#define VERTEX_PULLING_VERTEX_CHANNEL 14 // storage buffer channels that vertex pulling draws bind the geometry to
+#define VERTEX_PULLING_INDEX_CHANNEL 15
+
+#define GEOMETRY_POOL_INITIAL_SIZE (4 * 1024 * 1024) // in bytes
+#define TRANSIENT_ARENA_INITIAL_SIZE (1024 * 1024) // in bytes per frame in flight
+
+#define STREAMING_PARTITION_ALIGNMENT 256
+
+#define BUFFER_ARENA_SIZE (1024 * 1024) // in bytes
+#define BUFFER_SUBALLOCATION_MAX_SIZE (64 * 1024) // larger BUFFER_SUBALLOCATED buffers get storage of their own
+
+#define FILE_STAGING_CHUNK_SIZE (4 * 1024 * 1024) // in bytes
+#define FILE_STAGING_SLOTS 3 // chunks in flight while a file is uploaded
+
+#define COPY_GATHER_THRESHOLD 32 // merged copies between the same two buffers from which a gather kernel replaces the copies
 
 #define VERTEX_STANDARD  1   // pos,normal,tex0
 #define VERTEX_COMPACT   2   // pos,color
 #define VERTEX_COLOR     3   // pos,normal,color
 #define VERTEX_3_3_2     1   // 3 floats / 3 floats / 2 floats
 #define VERTEX_2_2_3     4   // 2 floats / 2 floats / 3 floats
+#define VERTEX_STANDARD_QUANTIZED 5 // 16-bit pos, octahedral normal, half float tex0
+#define VERTEX_COMPACT_QUANTIZED  6 // 16-bit pos, color
+#define VERTEX_COLOR_QUANTIZED    7 // 16-bit pos, octahedral normal, color
+
+#define INSTANCE_MATRIX 1       // float4x4 model matrix per instance, 64 bytes. In GLSL at locations 8 to 11, in Metal at buffer(1)
+#define INSTANCE_MATRIX_COLOR 2 // instance_matrix_color, 80 bytes. The color is at location 12
+#define INSTANCE_MATRIX_DATA 3  // instance_matrix_data, 80 bytes. The data is at location 12
+
+#define INDEX_TYPE_AUTO 0 // indices are written as uint32_t, and stored as 16-bit indices when the vertex count allows
+#define INDEX_TYPE_16   2 // indices are written as uint16_t
+#define INDEX_TYPE_32   4 // indices are written as uint32_t
 
 #define SHADER_VERTEX 1
 #define SHADER_FRAGMENT 2
@@ -99,6 +147,39 @@ namespace RenderDoos
     uint32_t c0;
     };
 
+  struct vertex_standard_quantized // 16 bytes
+    {
+    uint16_t x, y, z, w;  // unsigned normalized, relative to the geometry's bounding box
+    int16_t nx, ny;       // octahedral encoded normal
+    uint16_t u, v;        // half floats
+    };
+
+  struct vertex_compact_quantized // 12 bytes
+    {
+    uint16_t x, y, z, w;
+    uint32_t c0;
+    };
+
+  struct vertex_color_quantized // 16 bytes
+    {
+    uint16_t x, y, z, w;
+    int16_t nx, ny;
+    uint32_t c0;
+    };
+
+  struct instance_matrix_color
+    {
+    float4x4 model;
+    uint32_t color;
+    uint32_t padding[3];
+    };
+
+  struct instance_matrix_data
+    {
+    float4x4 model;
+    float4 data;
+    };
+
   struct texture
     {
     int32_t w, h;
@@ -114,15 +195,34 @@ namespace RenderDoos
     {
     int32_t type;       // 0 = unused, 1 = index, 2 = vertex
     int32_t size;       // size of the buffer in bytes    
+    int32_t capacity;   // bytes of gpu storage of a compute buffer, at least size
     uint32_t gl_buffer_id;
     uint8_t* raw;       // cpu memory
+    int32_t raw_size;   // size of the cpu memory in bytes
     void* metal_buffer;
+    int32_t flags;      // BUFFER_STREAMING
+    int32_t stride;     // distance in bytes between the ring partitions of a streaming buffer
+    int32_t partition;  // ring partition holding the latest data of a streaming buffer
+    uint8_t* mapped;    // persistently mapped gpu memory of a streaming buffer, or the mapping of a locked zero copy geometry
+    int32_t offset;     // in bytes in the shared storage of a BUFFER_SUBALLOCATED buffer
+    int32_t arena;      // index of the buffer arena of a BUFFER_SUBALLOCATED buffer
+    int32_t written;    // bytes of the partition of a streaming buffer written in written_frame
+    uint32_t written_frame;
+    };
+
+  struct dirty_range
+    {
+    int32_t offset;    // in bytes
+    int32_t size;      // in bytes
     };
 
   struct geometry_ref
     {
     int32_t buffer;    // buffer handle    
     int32_t count;     // number of elements
+    int32_t offset;    // first element inside the buffer of a geometry pool, 0 otherwise
+    int32_t number_of_dirty_ranges; // 0 or -1 if the whole buffer has to be sent to the gpu
+    dirty_range dirty_ranges[MAX_DIRTY_RANGES]; // sorted and disjoint
     };
 
   struct geometry_handle
@@ -134,6 +234,125 @@ namespace RenderDoos
     uint32_t gl_vertex_array_object_id; // vertex array object
     geometry_ref vertex; // vertex buffer
     geometry_ref index;  // index buffer
+    int32_t index_type;  // INDEX_TYPE_AUTO or INDEX_TYPE_16 or INDEX_TYPE_32
+    int32_t index_size;  // size of one index in bytes as it is stored on the gpu
+    int32_t flags;       // GEOMETRY_STREAMING or GEOMETRY_ZERO_COPY or GEOMETRY_POOLED
+    uint8_t* index_staging; // 32-bit indices of a pooled INDEX_TYPE_AUTO geometry between geometry_begin and geometry_end
+    float quantization_offset[3]; // decodes quantized positions: offset + extent * position
+    float quantization_extent[3];
+    int32_t instance_buffer; // buffer handle with per instance data, -1 if none
+    int32_t instance_layout; // INSTANCE_MATRIX or INSTANCE_MATRIX_COLOR or INSTANCE_MATRIX_DATA
+    };
+
+  struct submesh
+    {
+    int32_t geometry;    // geometry handle, -1 = unused
+    int32_t first_index; // relative to the indices of the geometry
+    int32_t index_count;
+    int32_t base_vertex; // added to each index
+    };
+
+  struct draw_command
+    {
+    int32_t geometry;       // geometry handle
+    int32_t first_index;    // relative to the indices of the geometry
+    int32_t index_count;    // -1 for all indices from first_index on
+    int32_t base_vertex;    // added to each index
+    int32_t instance_count;
+    int32_t base_instance;  // first instance in the instance buffer of the geometry
+    };
+
+  struct draw_indirect_command // layout of an indirect indexed draw in gpu memory, the same for opengl and metal
+    {
+    uint32_t index_count;
+    uint32_t instance_count;
+    uint32_t first_index;   // absolute in the index buffer of the geometry
+    int32_t base_vertex;    // absolute in the vertex buffer of the geometry
+    uint32_t base_instance;
+    };
+
+  struct transient_geometry // vertices and indices in the transient arena, valid until frame_end
+    {
+    int32_t vertex_declaration_type;
+    int32_t index_size;
+    int32_t vertex_offset;      // in vertices
+    int32_t index_offset;       // in indices
+    int32_t number_of_indices;
+    uint32_t frame;             // frame index of the allocation
+    };
+
+  struct geometry_pool
+    {
+    int32_t buffer;       // buffer handle, -1 until the first geometry is placed in the pool
+    int32_t element_size; // size of one vertex or index in bytes
+    offset_allocator allocator; // offsets and sizes are in elements
+    };
+
+  struct buffer_copy_region
+    {
+    int32_t source;        // buffer handle
+    int32_t destination;   // buffer handle
+    uint32_t read_offset;  // in bytes
+    uint32_t write_offset; // in bytes
+    uint32_t size;         // in bytes
+    };
+
+  struct buffer_arena
+    {
+    int32_t buffer;       // buffer handle of the shared storage, -1 until the first buffer is placed in the arena
+    offset_allocator allocator; // offsets and sizes are in units of the storage buffer offset alignment
+    };
+
+  struct render_statistics
+    {
+    uint64_t bytes_uploaded; // bytes written from the cpu to gpu buffers
+    uint64_t host_memory;    // bytes of cpu memory held for gpu buffers (shadow copies and staging blocks) at the end of the frame
+    uint64_t draw_calls;     // draw calls sent to the graphics api, a multi draw counts once
+    uint64_t batched_items;  // draw items submitted through render queues
+    uint64_t batched_draws;  // draws those items were merged into, batched_items / batched_draws is the merge ratio
+    uint64_t file_bytes_read; // bytes loaded with add_buffer_object_from_file
+    double file_read_seconds; // time spent in add_buffer_object_from_file, file_bytes_read / file_read_seconds / 1e6 is the throughput in MB/s
+    uint64_t pool_hits;      // resource pool requests served with a recycled resource
+    uint64_t pool_misses;    // resource pool requests that created a resource, pool_hits / (pool_hits + pool_misses) is the hit rate
+    uint64_t shared_memory_saved; // bytes of gpu memory that shared handles to identical data save, not a per frame counter
+    };
+
+#define RESOURCE_TEXTURE 1
+#define RESOURCE_GEOMETRY 2
+#define RESOURCE_BUFFER_OBJECT 3
+#define RESOURCE_FRAME_BUFFER 4
+
+  struct deferred_removal
+    {
+    int32_t type;   // RESOURCE_TEXTURE or RESOURCE_GEOMETRY or RESOURCE_BUFFER_OBJECT or RESOURCE_FRAME_BUFFER
+    int32_t handle;
+    uint32_t frame; // frame index at the time of the removal
+    };
+
+  struct deferred_range // range of a buffer arena or geometry pool that the gpu may still read, freed MAX_FRAMES_IN_FLIGHT frames after its release
+    {
+    offset_allocator* allocator;
+    uint32_t offset; // in the units of the allocator
+    uint32_t frame;
+    };
+
+  struct shared_resource // entry of the content table of add_texture_shared and add_buffer_object_shared
+    {
+    uint64_t hash[2];   // 128 bits of the shape and the bytes
+    int32_t type;       // RESOURCE_TEXTURE or RESOURCE_BUFFER_OBJECT
+    int32_t handle;
+    int32_t references;
+    int32_t gpu_size;   // in bytes
+    };
+
+  struct readback_handle
+    {
+    int32_t size;       // 0 = unused
+    int32_t capacity;   // bytes of staging storage, kept for the next readback in this slot
+    uint32_t gl_buffer_id;
+    uint8_t* mapped;    // persistently mapped staging storage
+    void* metal_buffer;
+    void* fence;        // GLsync, or the MTL::CommandBuffer that holds the copy
     };
 
   struct query_handle
@@ -273,7 +492,7 @@ namespace RenderDoos
       virtual ~render_context() {}
 
       void init();
-      void destroy();    
+      virtual void destroy();    
       
       virtual void frame_begin(render_drawables drawables) = 0;
       virtual void frame_end(bool wait_until_completed) = 0;
@@ -299,7 +518,13 @@ namespace RenderDoos
       virtual void get_data_from_texture(int32_t handle, void* data, int32_t size) = 0;
       virtual void copy_texture_data(int32_t source_handle, int32_t destination_handle) = 0;      
       
-      virtual int32_t add_geometry(int32_t vertex_declaration_type) = 0; // VERTEX_STANDARD or VERTEX_COMPACT or VERTEX_COLOR
+      // streaming geometries and buffers only keep the data of the frame in which they were last written, so rewrite them completely
+      // when they change. The ring partitions are protected by frame_begin / frame_end.
+      // zero copy geometries hand out mapped gpu memory in geometry_begin. Mark the changed bytes with geometry_dirty_range or
+      // write everything.
+      // pooled geometries share a few large buffers per vertex declaration and index size. The pointers of geometry_begin
+      // stay valid until the next geometry_begin of a pooled geometry, as a pool may have to grow.
+      virtual int32_t add_geometry(int32_t vertex_declaration_type, int32_t index_type = INDEX_TYPE_32, int32_t geometry_flags = 0) = 0; // VERTEX_STANDARD or VERTEX_COMPACT or VERTEX_COLOR
       virtual void remove_geometry(int32_t handle) = 0;
 
       virtual int32_t add_render_buffer() = 0;
@@ -307,12 +532,29 @@ namespace RenderDoos
 
       virtual int32_t add_buffer_object(const void* data, int32_t size, int32_t buffer_type = COMPUTE_BUFFER) = 0;
       virtual void remove_buffer_object(int32_t handle) = 0;
+      // maps the file and uploads [offset, offset + size) in chunks, size -1 reads up to the end of the file. Returns -1 if
+      // the file cannot be read or the range is empty or larger than 2 GB.
+      int32_t add_buffer_object_from_file(const char* filename, int64_t offset = 0, int64_t size = -1, int32_t buffer_type = COMPUTE_BUFFER, double* megabytes_per_second = nullptr);
       virtual void update_buffer_object(int32_t handle, const void* data, int32_t size, int32_t offset) = 0;
       virtual void bind_buffer_object(int32_t handle, int32_t channel, int32_t target) = 0;
       virtual void get_data_from_buffer_object(int32_t handle, void* data, int32_t size) = 0;
+      // asynchronous readback of size bytes at offset, copied when the gpu is done with the commands sent before. Not inside
+      // a render pass. Returns -1 if all MAX_READBACKS handles are pending.
+      virtual int32_t readback_buffer_object(int32_t handle, int32_t size, int32_t offset = 0) = 0;
+      virtual bool is_readback_ready(int32_t readback) = 0;
+      virtual void finish_readback(int32_t readback, void* data) = 0; // waits for the copy if needed, and releases the readback handle
       virtual const buffer_object* get_buffer_object(int32_t handle) const = 0;
       virtual void copy_buffer_object_data(int32_t source_handle, int32_t destination_handle, uint32_t read_offset, uint32_t write_offset, uint32_t size) = 0;
 
+      // update_buffer_object grows compute buffers geometrically and keeps their contents, the gpu copies them to the new
+      // storage. Rebind the buffer after it grew or shrunk.
+      virtual void reserve_buffer_object(int32_t handle, int32_t capacity) = 0; // storage for at least capacity bytes
+
+      virtual void shrink_buffer_object(int32_t handle) = 0; // releases the storage beyond size
+      // copies the regions in order, so a region may read what an earlier one wrote. Consecutive regions that continue each
+      // other are merged. The source and destination range of one region may not overlap.
+      virtual void copy_buffer_object_regions(const buffer_copy_region* regions, int32_t number_of_regions) = 0;
+
       virtual void dispatch_compute(int32_t num_groups_x, int32_t num_groups_y, int32_t num_groups_z, int32_t local_size_x, int32_t local_size_y, int32_t local_size_z) = 0;
 
       virtual int32_t add_frame_buffer(int32_t w, int32_t h, bool make_depth_texture, int32_t usage_flags) = 0;
@@ -323,6 +565,73 @@ namespace RenderDoos
       virtual void geometry_end(int32_t handle) = 0;
       virtual void geometry_draw(int32_t handle, int32_t instance_count) = 0;
 
+      void set_geometry_quantization(int32_t handle, const float4& bb_min, const float4& bb_max);
+
+      // per instance data for instanced draws, buffer_handle comes from add_buffer_object. Use -1 to detach the buffer.
+      void set_geometry_instances(int32_t handle, int32_t buffer_handle, int32_t instance_layout = INSTANCE_MATRIX);
+      const geometry_handle* get_geometry(int32_t handle) const; // nullptr if the handle is not in use
+
+      // draws the geometry from compute buffers, e.g. written by a compute shader, instead of geometry_begin. The layout is the
+      // vertex declaration and index type of the geometry, INDEX_TYPE_AUTO means 32-bit indices. A count of -1 takes the whole
+      // buffer. With geometry_draw_indirect the counts can come from a draw_indirect_command that a compute shader writes.
+      // The index buffer cannot be a streaming or suballocated buffer, as indirect draws address it from offset 0.
+      // Keep the buffers alive while the geometry uses them. Returns false if the geometry or the buffers cannot be used.
+      bool set_geometry_buffers(int32_t handle, int32_t vertex_buffer_handle, int32_t number_of_vertices, int32_t index_buffer_handle, int32_t number_of_indices);
+
+      // ranges of the indices of a geometry that are drawn on their own, so that one geometry can hold many meshes.
+      // Removing the geometry removes its submeshes.
+      int32_t add_submesh(int32_t geometry_handle, int32_t first_index, int32_t index_count, int32_t base_vertex = 0);
+      void remove_submesh(int32_t handle);
+      const submesh* get_submesh(int32_t handle) const;
+      void submesh_draw(int32_t handle, int32_t instance_count);
+
+      // draws the commands in order. Consecutive commands whose geometries share their buffers and vertex layout, e.g. pooled
+      // geometry or submeshes, are sent to the gpu as one multi draw.
+      virtual void geometry_draw_batch(const draw_command* commands, int32_t number_of_commands) = 0;
+
+      // suballocates vertices and indices from a linear arena that is reset every frame, for geometry that is rebuilt every
+      // frame such as ui or debug overlays. Write through the pointers before drawing, the memory is valid until frame_end.
+      // Returns false when the arena of this frame is full, the arena grows at the start of the next frame.
+      // Quantized vertex layouts are decoded with the unit bounding box.
+      bool transient_geometry_begin(transient_geometry& tg, int32_t vertex_declaration_type, int32_t number_of_vertices, int32_t number_of_indices, float** vertex_pointer, void** index_pointer, int32_t index_type = INDEX_TYPE_32);
+      virtual void transient_geometry_draw(const transient_geometry& tg, int32_t instance_count = 1) = 0;
+
+      // resolves the geometry relative ranges of command to the absolute ranges of an indirect draw. Returns false for
+      // streaming geometry, as its ring partition changes every frame, or when nothing is left to draw.
+      bool get_draw_indirect_command(const draw_command& command, draw_indirect_command& indirect) const;
+
+      // draws the draw_indirect_commands that the gpu wrote in command_buffer, e.g. with gpu_culling. All commands use the
+      // buffers and vertex layout of geometry. The number of commands is read from the first uint32 of count_buffer,
+      // up to max_commands, or all max_commands are drawn when count_buffer is -1.
+      virtual void geometry_draw_indirect(int32_t geometry, int32_t command_buffer, int32_t count_buffer, int32_t max_commands) = 0;
+
+      // call between geometry_begin and geometry_end to only send the changed bytes of the vertices (update = GEOMETRY_VERTEX)
+      // or indices (update = GEOMETRY_INDEX) to the gpu. Without dirty ranges geometry_end sends everything.
+      void geometry_dirty_range(int32_t handle, int32_t update, int32_t offset, int32_t size);
+
+      // compacts the geometry pools so that their free space forms one range. Call between frames, pools with locked
+      // geometries are skipped.
+      void defragment_geometry_pools();
+
+      const render_statistics& get_statistics() const { return _frame_statistics; } // statistics of the last finished frame
+      void record_batching(int32_t number_of_items, int32_t number_of_draws); // called by render queues
+      void record_pool_request(bool hit); // called by resource pools
+      uint32_t get_frame_index() const { return _frame_index; } // number of finished frames
+      uint32_t get_geometry_pool_version() const { return _geometry_pool_version; } // changes when pooled geometry moves to another range, e.g. on defragment_geometry_pools
+
+      // removes the resource once the gpu finished the frames that may still use it, at a later frame_begin. The handle
+      // stays in use until then. Resource types are RESOURCE_TEXTURE, RESOURCE_GEOMETRY, RESOURCE_BUFFER_OBJECT and RESOURCE_FRAME_BUFFER.
+      void remove_deferred(int32_t resource_type, int32_t handle);
+      void flush_deferred_removals(); // removes everything in the queue now, when the gpu is idle
+
+      // uploads with the same shape and bytes share one handle, found by a 128-bit hash of the data. Do not update shared
+      // resources, and give them back with release_shared, which removes them with the last reference. Removing a shared
+      // resource directly drops it from the table for all its users. Streaming buffers and formats that add_texture cannot
+      // fill from 8-bit data are not shared.
+      int32_t add_texture_shared(int32_t w, int32_t h, int32_t format, const uint8_t* data, int32_t usage_flags);
+      int32_t add_buffer_object_shared(const void* data, int32_t size, int32_t buffer_type = COMPUTE_BUFFER);
+      void release_shared(int32_t resource_type, int32_t handle); // RESOURCE_TEXTURE or RESOURCE_BUFFER_OBJECT, handles that are not shared are removed
+
       virtual int32_t add_shader(const char* source, int32_t type, const char* name) = 0;
       virtual void remove_shader(int32_t handle) = 0;
 
@@ -348,6 +657,52 @@ namespace RenderDoos
 
       virtual void* get_command_buffer() = 0;
 
+    protected:
+      int32_t _get_index_size(const geometry_handle* gh, int32_t number_of_vertices) const;
+      int32_t _get_instance_size(int32_t instance_layout) const;
+      void _narrow_indices(geometry_handle* gh, uint8_t* destination = nullptr, const uint8_t* source = nullptr); // INDEX_TYPE_AUTO: converts the 32-bit indices written by the user in source (default raw) to 16-bit indices, in place if destination is nullptr
+
+      void _add_dirty_range(geometry_ref& ref, int32_t offset, int32_t size);
+      void _finish_frame_statistics();
+
+      uint8_t* _allocate_host_memory(buffer_object* buf, int32_t size); // replaces raw
+      void _free_host_memory(buffer_object* buf);
+      void _grow_host_memory(buffer_object* buf, int32_t size); // replaces raw, keeps its contents
+
+      geometry_pool* _get_geometry_pool(const geometry_handle* gh, int32_t type);
+      uint8_t* _allocate_pooled(geometry_ref& ref, geometry_pool* pool, int32_t count, int32_t type); // returns the cpu memory of the geometry inside the pool
+      void _release_pooled(geometry_ref& ref);
+      uint32_t _get_pool_elements(const geometry_pool* pool, int32_t count) const; // size of the range of count elements
+      virtual void _update_geometry_pool(buffer_object* buf, int32_t size) = 0; // resizes the gpu buffer to raw_size if needed and sends the first size bytes of raw
+
+      virtual void _geometry_draw(int32_t handle, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance = 0) = 0;
+      void _remove_submeshes(int32_t geometry_handle);
+      bool _clip_index_range(const geometry_handle* gh, int32_t& first_index, int32_t& index_count) const; // false if nothing is left to draw
+      int32_t _get_vertex_size(int32_t vertex_declaration_type) const;
+      geometry_handle* _get_transient_handle(const transient_geometry& tg); // the shared handle of the vertex layout pointed at tg, nullptr if tg is stale
+
+      uint8_t* _streaming_partition(buffer_object* buf); // makes the partition of the current frame the latest and returns its memory
+      void _check_streaming_write(const buffer_object* buf, int32_t offset, int32_t size) const; // throws for writes that are not once per frame, front to back
+      void _release_deferred_removals(); // the removals of frames that the gpu finished, called in frame_begin
+      void _remove_resource(int32_t resource_type, int32_t handle);
+      int32_t _find_shared(const uint64_t hash[2], int32_t type, int32_t w, int32_t h, int32_t format, int32_t usage_flags) const; // index in _shared_resources, or -1
+      void _forget_shared(int32_t resource_type, int32_t handle); // drops the entry of a resource that is removed, so that its reused handle is not shared
+
+      int32_t _partition_offset(const buffer_object* buf) const; // offset in bytes of the latest partition of a streaming buffer or of the range of a suballocated buffer, else 0
+
+      bool _suballocate(buffer_object* buf, int32_t size); // places buf in a range of an arena with room for size bytes, false if size is too large or the arenas are full
+      void _release_suballocated(const buffer_object* buf); // the range is reused once the gpu finished the frames in flight
+      void _defer_range(offset_allocator* allocator, uint32_t offset);
+      void _free_deferred_ranges(bool all);
+      virtual int32_t _get_storage_offset_alignment() = 0;
+
+      virtual void _stage_buffer_object_data(int32_t handle, const uint8_t* data, int32_t size, int32_t offset) = 0; // at most FILE_STAGING_CHUNK_SIZE bytes
+      virtual void _finish_staging() = 0; // waits until the staged chunks are in their buffers
+
+      // fills _copy_regions with the regions in terms of the buffers that own the storage and offsets in that storage,
+      // in order and with consecutive regions that continue each other merged
+      void _merge_copy_regions(const buffer_copy_region* regions, int32_t number_of_regions);
+
     protected:
       texture _textures[MAX_TEXTURE];
       geometry_handle _geometry_handles[MAX_GEOMETRY];
@@ -358,6 +713,26 @@ namespace RenderDoos
       frame_buffer _frame_buffers[MAX_FRAMEBUFFER];
       uniform_value _uniforms[MAX_UNIFORMS];
       query_handle _queries[MAX_QUERIES];
+      readback_handle _readbacks[MAX_READBACKS];
+      std::vector<deferred_removal> _deferred_removals; // in the order of removal
+      std::vector<deferred_range> _deferred_ranges; // in the order of release
+      std::vector<shared_resource> _shared_resources;
+      geometry_pool _vertex_pools[VERTEX_COLOR_QUANTIZED + 1]; // per vertex declaration type
+      geometry_pool _index_pools[2]; // 16-bit and 32-bit indices
+      buffer_arena _buffer_arenas[MAX_BUFFER_ARENA];
+      int32_t _storage_offset_alignment; // 0 until the first suballocation
+      std::vector<buffer_copy_region> _copy_regions;
+      submesh _submeshes[MAX_SUBMESH];
+      geometry_handle _transient_handles[VERTEX_COLOR_QUANTIZED + 1]; // per vertex declaration type, not in _geometry_handles
+      int32_t _transient_arena; // streaming buffer handle
+      int32_t _transient_cursor; // in bytes in the partition of this frame
+      int32_t _transient_required; // bytes asked for this frame, including the failed allocations
+      uint32_t _transient_frame;
+      uint8_t* _transient_memory; // partition of this frame
+      uint32_t _frame_index; // number of finished frames, selects the ring partition that streaming buffers write to
+      uint32_t _geometry_pool_version;
+      render_statistics _statistics; // statistics of the current frame
+      render_statistics _frame_statistics;
       bool _initialized;
     };
 
@@ -1,8 +1,10 @@
 #include "render_context_gl.h"
+#include "packing.h"
 #include <GL/glew.h>
 #include <string>
 #include <sstream>
 #include <stdexcept>
+#include <algorithm>
 
 #include "types.h"
 
@@ -60,73 +62,181 @@ namespace RenderDoos
       int offset;
       int tupleSize;
       int stride;
+      GLboolean normalized;
       };
 
     static gl_buffer_declaration gl_buffer_declaration_standard[] =
       {
-          { 0, GL_FLOAT, 0, 3, sizeof(GLfloat) * 8}, // x y z
-          { 1, GL_FLOAT, sizeof(GLfloat) * 3, 3, sizeof(GLfloat) * 8}, // nx ny nz
-          { 2, GL_FLOAT, sizeof(GLfloat) * 6, 2, sizeof(GLfloat) * 8}, // u v
-          { 0, 0, 0, 0, 0} // end
+          { 0, GL_FLOAT, 0, 3, sizeof(GLfloat) * 8, GL_FALSE}, // x y z
+          { 1, GL_FLOAT, sizeof(GLfloat) * 3, 3, sizeof(GLfloat) * 8, GL_FALSE}, // nx ny nz
+          { 2, GL_FLOAT, sizeof(GLfloat) * 6, 2, sizeof(GLfloat) * 8, GL_FALSE}, // u v
+          { 0, 0, 0, 0, 0, GL_FALSE} // end
       };
 
     static gl_buffer_declaration gl_buffer_declaration_compact[] =
       {
-          { 0, GL_FLOAT, 0, 3, sizeof(GLfloat) * 4}, // x y z
-          { 1, GL_UNSIGNED_INT, sizeof(GLfloat) * 3, 1, sizeof(GLfloat) * 4}, // c0          
-          { 0, 0, 0, 0, 0} // end
+          { 0, GL_FLOAT, 0, 3, sizeof(GLfloat) * 4, GL_FALSE}, // x y z
+          { 1, GL_UNSIGNED_INT, sizeof(GLfloat) * 3, 1, sizeof(GLfloat) * 4, GL_FALSE}, // c0          
+          { 0, 0, 0, 0, 0, GL_FALSE} // end
       };
 
     static gl_buffer_declaration gl_buffer_declaration_color[] =
       {
-          { 0, GL_FLOAT, 0, 3, sizeof(GLfloat) * 7}, // x y z
-          { 1, GL_FLOAT, sizeof(GLfloat) * 3, 3, sizeof(GLfloat) * 7}, // nx ny nz
-          { 2, GL_UNSIGNED_INT, sizeof(GLfloat) * 6, 1, sizeof(GLfloat) * 7}, // c0          
-          { 0, 0, 0, 0, 0} // end
+          { 0, GL_FLOAT, 0, 3, sizeof(GLfloat) * 7, GL_FALSE}, // x y z
+          { 1, GL_FLOAT, sizeof(GLfloat) * 3, 3, sizeof(GLfloat) * 7, GL_FALSE}, // nx ny nz
+          { 2, GL_UNSIGNED_INT, sizeof(GLfloat) * 6, 1, sizeof(GLfloat) * 7, GL_FALSE}, // c0          
+          { 0, 0, 0, 0, 0, GL_FALSE} // end
       };
 
     static gl_buffer_declaration gl_buffer_declaration_2_2_3[] =
       {
-          { 0, GL_FLOAT, 0, 2, sizeof(GLfloat) * 7}, // a b
-          { 1, GL_FLOAT, sizeof(GLfloat) * 2, 2, sizeof(GLfloat) * 7}, // c d
-          { 2, GL_FLOAT, sizeof(GLfloat) * 4, 3, sizeof(GLfloat) * 7}, // e f g
-          { 0, 0, 0, 0, 0} // end
+          { 0, GL_FLOAT, 0, 2, sizeof(GLfloat) * 7, GL_FALSE}, // a b
+          { 1, GL_FLOAT, sizeof(GLfloat) * 2, 2, sizeof(GLfloat) * 7, GL_FALSE}, // c d
+          { 2, GL_FLOAT, sizeof(GLfloat) * 4, 3, sizeof(GLfloat) * 7, GL_FALSE}, // e f g
+          { 0, 0, 0, 0, 0, GL_FALSE} // end
+      };
+
+    static gl_buffer_declaration gl_buffer_declaration_standard_quantized[] =
+      {
+          { 0, GL_UNSIGNED_SHORT, 0, 3, 16, GL_TRUE}, // x y z
+          { 1, GL_SHORT, 8, 2, 16, GL_TRUE}, // octahedral normal
+          { 2, GL_HALF_FLOAT, 12, 2, 16, GL_FALSE}, // u v
+          { 0, 0, 0, 0, 0, GL_FALSE} // end
+      };
+
+    static gl_buffer_declaration gl_buffer_declaration_compact_quantized[] =
+      {
+          { 0, GL_UNSIGNED_SHORT, 0, 3, 12, GL_TRUE}, // x y z
+          { 1, GL_UNSIGNED_INT, 8, 1, 12, GL_FALSE}, // c0
+          { 0, 0, 0, 0, 0, GL_FALSE} // end
+      };
+
+    static gl_buffer_declaration gl_buffer_declaration_color_quantized[] =
+      {
+          { 0, GL_UNSIGNED_SHORT, 0, 3, 16, GL_TRUE}, // x y z
+          { 1, GL_SHORT, 8, 2, 16, GL_TRUE}, // octahedral normal
+          { 2, GL_UNSIGNED_INT, 12, 1, 16, GL_FALSE}, // c0
+          { 0, 0, 0, 0, 0, GL_FALSE} // end
       };
 
     struct gl_buffer_declaration_table_struct
       {
       int32_t size;                       // size in bytes
       gl_buffer_declaration* declaration; // declaration
+      bool quantized;                     // positions need the geometry's quantization offset and extent
       };
 
     static gl_buffer_declaration_table_struct gl_buffer_declaration_table[] =
       {
-        {0, 0},
-        {32, gl_buffer_declaration_standard},
-        {16, gl_buffer_declaration_compact},
-        {28, gl_buffer_declaration_color},
-        {28, gl_buffer_declaration_2_2_3},
+        {0, 0, false},
+        {32, gl_buffer_declaration_standard, false},
+        {16, gl_buffer_declaration_compact, false},
+        {28, gl_buffer_declaration_color, false},
+        {28, gl_buffer_declaration_2_2_3, false},
+        {16, gl_buffer_declaration_standard_quantized, true},
+        {12, gl_buffer_declaration_compact_quantized, true},
+        {16, gl_buffer_declaration_color_quantized, true},
       };
+
+    // generic attribute locations that carry the quantization constants of a geometry
+#define QUANTIZATION_OFFSET_LOCATION 6
+#define QUANTIZATION_EXTENT_LOCATION 7
+    // generic attribute location with the first index, base vertex, index size and words per vertex of a vertex pulling draw
+#define VERTEX_PULLING_LOCATION 5
+    // attribute locations of the per instance data: the columns of the model matrix, followed by the color or custom data
+#define INSTANCE_MODEL_LOCATION 8
+#define INSTANCE_EXTRA_LOCATION 12
+
+    // gpu storage of geometry is padded to whole 32-bit words, so that vertex pulling shaders can read 16-bit indices as uint
+    inline GLsizeiptr padded_geometry_size(int32_t size)
+      {
+      return (size + 3) & ~3;
+      }
     }
 
-  render_context_gl::render_context_gl() : render_context()
+  render_context_gl::render_context_gl() : render_context(), _vertex_pulling_vertex_array_object_id(0), _indirect_buffer(-1), _indirect_cursor(0), _indirect_frame(0),
+    _staging_buffer_id(0), _staging_mapped(nullptr), _staging_slot(0), _gather_program_id(0), _gather_buffer_id(0)
     {
+    for (int32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+      _frame_fences[i] = nullptr;
+    for (int32_t i = 0; i < FILE_STAGING_SLOTS; ++i)
+      _staging_fences[i] = nullptr;
     }
 
   render_context_gl::~render_context_gl()
     {
     }
 
+  void render_context_gl::destroy()
+    {
+    render_context::destroy();
+    _indirect_buffer = -1; // removed with the other buffer objects
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+      {
+      if (_frame_fences[i])
+        {
+        glDeleteSync((GLsync)_frame_fences[i]);
+        _frame_fences[i] = nullptr;
+        }
+      }
+    for (int i = 0; i <= VERTEX_COLOR_QUANTIZED; ++i) // the vertex array objects of the transient layouts are made on their first draw
+      {
+      geometry_handle* gh = &_transient_handles[i];
+      if (gh->gl_vertex_array_object_id != 0)
+        {
+        glDeleteVertexArrays(1, &gh->gl_vertex_array_object_id);
+        gh->gl_vertex_array_object_id = 0;
+        }
+      }
+    if (_vertex_pulling_vertex_array_object_id != 0)
+      {
+      glDeleteVertexArrays(1, &_vertex_pulling_vertex_array_object_id);
+      _vertex_pulling_vertex_array_object_id = 0;
+      }
+    if (_gather_program_id != 0)
+      {
+      glDeleteProgram(_gather_program_id);
+      glDeleteBuffers(1, &_gather_buffer_id);
+      _gather_program_id = 0;
+      _gather_buffer_id = 0;
+      }
+    for (int i = 0; i < MAX_READBACKS; ++i) // pending readbacks are dropped
+      {
+      readback_handle* rb = &_readbacks[i];
+      if (rb->fence)
+        glDeleteSync((GLsync)rb->fence);
+      if (rb->gl_buffer_id != 0)
+        {
+        glUnmapNamedBuffer(rb->gl_buffer_id);
+        glDeleteBuffers(1, &rb->gl_buffer_id);
+        }
+      memset(rb, 0, sizeof(readback_handle));
+      }
+    }
+
   void render_context_gl::frame_begin(render_drawables)
     {
     // lock semaphore here?
     _semaphore.lock();
+    _release_deferred_removals();
     }
 
   void render_context_gl::frame_end(bool wait_until_completed)
     {
     if (wait_until_completed)
       glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    _frame_fences[_frame_index % MAX_FRAMES_IN_FLIGHT] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++_frame_index;
+    _finish_frame_statistics();
+    // the next frame writes to the ring partitions of frame _frame_index - MAX_FRAMES_IN_FLIGHT, so wait until the gpu is done with it
+    GLsync fence = (GLsync)_frame_fences[_frame_index % MAX_FRAMES_IN_FLIGHT];
+    if (fence)
+      {
+      while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+        ;
+      glDeleteSync(fence);
+      _frame_fences[_frame_index % MAX_FRAMES_IN_FLIGHT] = nullptr;
+      }
     // release semaphore here?
     _semaphore.unlock();
     }
@@ -490,6 +600,8 @@ namespace RenderDoos
     texture* tex = &_textures[handle];
     if (tex->flags == 0)
       return;
+    if (!_shared_resources.empty())
+      _forget_shared(RESOURCE_TEXTURE, handle);
     glDeleteTextures(1, &tex->gl_texture_id);
     glCheckError();
     tex->flags = 0;
@@ -655,9 +767,13 @@ namespace RenderDoos
       }
     }
 
-  int32_t render_context_gl::add_geometry(int32_t vertex_declaration_type)
+  int32_t render_context_gl::add_geometry(int32_t vertex_declaration_type, int32_t index_type, int32_t geometry_flags)
     {
-    if (vertex_declaration_type < VERTEX_STANDARD || vertex_declaration_type > VERTEX_2_2_3)
+    if (vertex_declaration_type < VERTEX_STANDARD || vertex_declaration_type > VERTEX_COLOR_QUANTIZED)
+      return -1;
+    if (index_type != INDEX_TYPE_AUTO && index_type != INDEX_TYPE_16 && index_type != INDEX_TYPE_32)
+      return -1;
+    if ((geometry_flags & GEOMETRY_POOLED) && (geometry_flags & (GEOMETRY_STREAMING | GEOMETRY_ZERO_COPY)))
       return -1;
     geometry_handle* gh = _geometry_handles;
     for (int32_t i = 0; i < MAX_GEOMETRY; ++i)
@@ -671,6 +787,10 @@ namespace RenderDoos
         gh->locked = 0;
         gh->vertex.buffer = -1;
         gh->index.buffer = -1;
+        gh->index_type = index_type;
+        gh->index_size = index_type == INDEX_TYPE_16 ? sizeof(uint16_t) : sizeof(uint32_t);
+        gh->flags = geometry_flags;
+        gh->instance_buffer = -1;
         glGenVertexArrays(1, &gh->gl_vertex_array_object_id);
         glCheckError();
         return i;
@@ -691,23 +811,53 @@ namespace RenderDoos
       if (buf->size == 0)
         {
         buf->size = size;
+        buf->capacity = size;
+        buf->flags = buffer_type & ~(BUFFER_TYPE_MASK | BUFFER_SUBALLOCATED);
+        buf->offset = 0;
+        buf->arena = -1;
+        if ((buffer_type & BUFFER_SUBALLOCATED) && (buffer_type & BUFFER_TYPE_MASK) == COMPUTE_BUFFER && !(buf->flags & BUFFER_STREAMING) && _suballocate(buf, size))
+          {
+          buf->type = COMPUTE_BUFFER;
+          if (data)
+            {
+            glNamedBufferSubData(buf->gl_buffer_id, buf->offset, size, data);
+            _statistics.bytes_uploaded += size;
+            }
+          glCheckError();
+          _last_assigned_buffer_object_id = i;
+          return i;
+          }
         glGenBuffers(1, &buf->gl_buffer_id);
         glCheckError();
-        switch (buffer_type)
+        switch (buffer_type & BUFFER_TYPE_MASK)
           {
           case ATOMIC_COUNTER_BUFFER:
             buf->type = ATOMIC_COUNTER_BUFFER;
-            glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, buf->gl_buffer_id);
-            glBufferData(GL_ATOMIC_COUNTER_BUFFER, size, data, GL_DYNAMIC_DRAW);
             break;
           case COMPUTE_BUFFER:
             buf->type = COMPUTE_BUFFER;
-            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf->gl_buffer_id);
-            glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_DRAW);
             break;
           default:
             assert(0);
           }
+        GLenum target = buf->type == ATOMIC_COUNTER_BUFFER ? GL_ATOMIC_COUNTER_BUFFER : GL_SHADER_STORAGE_BUFFER;
+        if (buf->flags & BUFFER_STREAMING)
+          {
+          _create_streaming_storage(buf, target);
+          if (data)
+            {
+            memcpy(_streaming_partition(buf), data, size);
+            buf->written = size;
+            buf->written_frame = _frame_index;
+            }
+          }
+        else
+          {
+          glBindBuffer(target, buf->gl_buffer_id);
+          glBufferData(target, size, data, GL_DYNAMIC_DRAW);
+          }
+        if (data)
+          _statistics.bytes_uploaded += size;
         glCheckError();
         _last_assigned_buffer_object_id = i;
         return i;
@@ -721,15 +871,38 @@ namespace RenderDoos
     if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
       return;
     buffer_object* buf = &_buffer_objects[handle];
-    if (buf->size > 0)
+    if (!_shared_resources.empty())
+      _forget_shared(RESOURCE_BUFFER_OBJECT, handle);
+    if (buf->size > 0 && (buf->flags & BUFFER_SUBALLOCATED))
+      _release_suballocated(buf);
+    else if (buf->size > 0)
       {
-      delete[] buf->raw;
+      _free_host_memory(buf);
       glDeleteBuffers(1, &buf->gl_buffer_id);
       glCheckError();
       }
     buf->size = 0;
+    buf->capacity = 0;
     buf->raw = nullptr;
     buf->type = 0;
+    buf->flags = 0;
+    buf->mapped = nullptr;
+    buf->offset = 0;
+    buf->arena = -1;
+    }
+
+  void render_context_gl::_create_streaming_storage(buffer_object* buf, uint32_t target)
+    {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    buf->stride = ((buf->size > 0 ? buf->size : 1) + STREAMING_PARTITION_ALIGNMENT - 1) & ~(STREAMING_PARTITION_ALIGNMENT - 1);
+    buf->partition = 0;
+    buf->written = 0;
+    glBindBuffer(target, buf->gl_buffer_id);
+    glBufferStorage(target, buf->stride * MAX_FRAMES_IN_FLIGHT, nullptr, flags);
+    buf->mapped = (uint8_t*)glMapBufferRange(target, 0, buf->stride * MAX_FRAMES_IN_FLIGHT, flags);
+    glCheckError();
+    if (!buf->mapped)
+      throw std::runtime_error("Could not map streaming buffer");
     }
 
   void render_context_gl::update_buffer_object(int32_t handle, const void* data, int32_t size, int32_t offset)
@@ -737,31 +910,144 @@ namespace RenderDoos
     if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
       return;
     buffer_object* buf = &_buffer_objects[handle];
-    if (buf->size > 0)
+    if (buf->size > 0 && (buf->flags & BUFFER_STREAMING))
       {
-      switch (buf->type)
+      _check_streaming_write(buf, offset, size);
+      if (offset + size > buf->size) // storage is immutable, so make a new buffer
         {
-        case ATOMIC_COUNTER_BUFFER:
-          glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, buf->gl_buffer_id);
-          if (size > buf->size) {
-            glBufferData(GL_ATOMIC_COUNTER_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
-            buf->size = size;
-          }
-          glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, offset, size, data);
-          break;
-        default:
-          glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf->gl_buffer_id);
-          if (size > buf->size) {
-            glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
-            buf->size = size;
-          }
-          glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, data);
-          break;
+        glDeleteBuffers(1, &buf->gl_buffer_id);
+        glGenBuffers(1, &buf->gl_buffer_id);
+        buf->size = offset + size;
+        buf->capacity = buf->size;
+        _create_streaming_storage(buf, buf->type == ATOMIC_COUNTER_BUFFER ? GL_ATOMIC_COUNTER_BUFFER : GL_SHADER_STORAGE_BUFFER);
         }
+      memcpy(_streaming_partition(buf) + offset, data, size);
+      buf->written = offset + size;
+      buf->written_frame = _frame_index;
+      _statistics.bytes_uploaded += size;
+      }
+    else if (buf->size > 0)
+      {
+      if (offset + size > std::max(buf->capacity, buf->size)) // geometric growth, so that appending is amortized
+        _resize_buffer_object(buf, std::max(offset + size, 2 * std::max(buf->capacity, buf->size)));
+      if (offset + size > buf->size)
+        buf->size = offset + size;
+      GLenum target = buf->type == ATOMIC_COUNTER_BUFFER ? GL_ATOMIC_COUNTER_BUFFER : GL_SHADER_STORAGE_BUFFER;
+      glBindBuffer(target, buf->gl_buffer_id);
+      glBufferSubData(target, _partition_offset(buf) + offset, size, data);
+      _statistics.bytes_uploaded += size;
+      glCheckError();
+      }
+    }
+
+  void render_context_gl::reserve_buffer_object(int32_t handle, int32_t capacity)
+    {
+    if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
+      return;
+    buffer_object* buf = &_buffer_objects[handle];
+    if (buf->size == 0 || (buf->flags & (BUFFER_STREAMING | BUFFER_POOLED)))
+      return;
+    if (capacity > std::max(buf->capacity, buf->size))
+      _resize_buffer_object(buf, capacity);
+    }
+
+  void render_context_gl::shrink_buffer_object(int32_t handle)
+    {
+    if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
+      return;
+    buffer_object* buf = &_buffer_objects[handle];
+    if (buf->size == 0 || (buf->flags & (BUFFER_STREAMING | BUFFER_POOLED)))
+      return;
+    if (buf->capacity > buf->size)
+      _resize_buffer_object(buf, buf->size);
+    }
+
+  void render_context_gl::_resize_buffer_object(buffer_object* buf, int32_t capacity)
+    {
+    // a suballocated buffer moves to another range, or to storage of its own when it outgrew the arenas
+    const buffer_object old = *buf;
+    if (!(old.flags & BUFFER_SUBALLOCATED) || !_suballocate(buf, capacity))
+      {
+      GLenum target = buf->type == ATOMIC_COUNTER_BUFFER ? GL_ATOMIC_COUNTER_BUFFER : GL_SHADER_STORAGE_BUFFER;
+      glGenBuffers(1, &buf->gl_buffer_id);
+      glBindBuffer(target, buf->gl_buffer_id);
+      glBufferData(target, capacity, nullptr, GL_DYNAMIC_DRAW);
+      buf->flags &= ~BUFFER_SUBALLOCATED;
+      buf->offset = 0;
+      buf->arena = -1;
+      buf->capacity = capacity;
+      }
+    int32_t keep = std::min(buf->size, capacity);
+    if (keep > 0)
+      glCopyNamedBufferSubData(old.gl_buffer_id, buf->gl_buffer_id, _partition_offset(&old), _partition_offset(buf), keep);
+    if (old.flags & BUFFER_SUBALLOCATED)
+      _release_suballocated(&old);
+    else
+      glDeleteBuffers(1, &old.gl_buffer_id);
+    buf->size = keep;
+    glCheckError();
+    }
+
+  void render_context_gl::_stage_buffer_object_data(int32_t handle, const uint8_t* data, int32_t size, int32_t offset)
+    {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    if (_staging_buffer_id == 0)
+      {
+      glGenBuffers(1, &_staging_buffer_id);
+      glBindBuffer(GL_COPY_READ_BUFFER, _staging_buffer_id);
+      glBufferStorage(GL_COPY_READ_BUFFER, FILE_STAGING_CHUNK_SIZE * FILE_STAGING_SLOTS, nullptr, flags);
+      _staging_mapped = (uint8_t*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, FILE_STAGING_CHUNK_SIZE * FILE_STAGING_SLOTS, flags);
+      glCheckError();
+      if (!_staging_mapped)
+        throw std::runtime_error("Could not map staging buffer");
+      _staging_slot = 0;
+      }
+    GLsync fence = (GLsync)_staging_fences[_staging_slot];
+    if (fence) // the copy out of this slot has to be done before it is overwritten
+      {
+      while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+        ;
+      glDeleteSync(fence);
+      }
+    memcpy(_staging_mapped + _staging_slot * FILE_STAGING_CHUNK_SIZE, data, size);
+    buffer_object* buf = &_buffer_objects[handle];
+    glCopyNamedBufferSubData(_staging_buffer_id, buf->gl_buffer_id, _staging_slot * FILE_STAGING_CHUNK_SIZE, _partition_offset(buf) + offset, size);
+    _staging_fences[_staging_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _staging_slot = (_staging_slot + 1) % FILE_STAGING_SLOTS;
+    _statistics.bytes_uploaded += size;
+    glCheckError();
+    }
+
+  void render_context_gl::_finish_staging()
+    {
+    for (int32_t i = 0; i < FILE_STAGING_SLOTS; ++i)
+      {
+      GLsync fence = (GLsync)_staging_fences[i];
+      if (!fence)
+        continue;
+      while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+        ;
+      glDeleteSync(fence);
+      _staging_fences[i] = nullptr;
+      }
+    if (_staging_buffer_id != 0)
+      {
+      glBindBuffer(GL_COPY_READ_BUFFER, _staging_buffer_id);
+      glUnmapBuffer(GL_COPY_READ_BUFFER);
+      glDeleteBuffers(1, &_staging_buffer_id);
+      _staging_buffer_id = 0;
+      _staging_mapped = nullptr;
       glCheckError();
       }
     }
 
+  int32_t render_context_gl::_get_storage_offset_alignment()
+    {
+    GLint alignment = 0;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return (int32_t)alignment;
+    }
+
   void render_context_gl::bind_buffer_object(int32_t handle, int32_t channel, int32_t target)
     {
     if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
@@ -769,23 +1055,28 @@ namespace RenderDoos
     buffer_object* buf = &_buffer_objects[handle];
     if (buf->size > 0)
       {
+      GLenum gl_target;
       switch (buf->type)
         {
         case GEOMETRY_VERTEX:
-          glBindBufferBase(GL_ARRAY_BUFFER, channel, buf->gl_buffer_id);
+          gl_target = GL_ARRAY_BUFFER;
           break;
         case GEOMETRY_INDEX:
-          glBindBufferBase(GL_ELEMENT_ARRAY_BUFFER, channel, buf->gl_buffer_id);
+          gl_target = GL_ELEMENT_ARRAY_BUFFER;
           break;
         case COMPUTE_BUFFER:
-          glBindBufferBase(GL_SHADER_STORAGE_BUFFER, channel, buf->gl_buffer_id);
+          gl_target = GL_SHADER_STORAGE_BUFFER;
           break;
         case ATOMIC_COUNTER_BUFFER:
-          glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, channel, buf->gl_buffer_id);
+          gl_target = GL_ATOMIC_COUNTER_BUFFER;
           break;
         default:
-          break;
+          return;
         }
+      if (buf->flags & (BUFFER_STREAMING | BUFFER_SUBALLOCATED))
+        glBindBufferRange(gl_target, channel, buf->gl_buffer_id, _partition_offset(buf), buf->size);
+      else
+        glBindBufferBase(gl_target, channel, buf->gl_buffer_id);
 
       glCheckError();
       }
@@ -807,10 +1098,125 @@ namespace RenderDoos
     buffer_object* src = &_buffer_objects[source_handle];
     buffer_object* dst = &_buffer_objects[destination_handle];
 
-    glCopyNamedBufferSubData(src->gl_buffer_id, dst->gl_buffer_id, read_offset, write_offset, size);
+    glCopyNamedBufferSubData(src->gl_buffer_id, dst->gl_buffer_id, read_offset + _partition_offset(src), write_offset + _partition_offset(dst), size);
+    glCheckError();
+    }
+
+  namespace
+    {
+    const char* gather_copy_shader = R"(#version 430 core
+layout (local_size_x = 64) in;
+layout (std430, binding = 0) readonly buffer Source { uint source[]; };
+layout (std430, binding = 1) writeonly buffer Destination { uint destination[]; };
+layout (std430, binding = 2) readonly buffer Regions { uvec4 regions[]; }; // read word, write word, number of words
+
+void main()
+  {
+  for (uint r = gl_WorkGroupID.x; r < uint(regions.length()); r += gl_NumWorkGroups.x)
+    {
+    uvec4 region = regions[r];
+    for (uint w = gl_LocalInvocationID.x; w < region.z; w += 64u)
+      destination[region.y + w] = source[region.x + w];
+    }
+  }
+)";
+
+    bool is_word_aligned(const buffer_copy_region& region)
+      {
+      return ((region.read_offset | region.write_offset | region.size) & 3) == 0;
+      }
+
+    // the gather kernel copies the regions in parallel, which is only the same as copying them in order if no region writes
+    // bytes that another region writes
+    bool writes_overlap(const buffer_copy_region* regions, size_t number_of_regions, std::vector<std::pair<uint32_t, uint32_t>>& ranges)
+      {
+      ranges.clear();
+      for (size_t i = 0; i < number_of_regions; ++i)
+        ranges.emplace_back(regions[i].write_offset, regions[i].write_offset + regions[i].size);
+      std::sort(ranges.begin(), ranges.end());
+      for (size_t i = 1; i < ranges.size(); ++i)
+        {
+        if (ranges[i].first < ranges[i - 1].second)
+          return true;
+        }
+      return false;
+      }
+    }
+
+  void render_context_gl::copy_buffer_object_regions(const buffer_copy_region* regions, int32_t number_of_regions)
+    {
+    _merge_copy_regions(regions, number_of_regions);
+    size_t first = 0;
+    while (first < _copy_regions.size())
+      {
+      size_t last = first + 1;
+      bool aligned = is_word_aligned(_copy_regions[first]);
+      while (last < _copy_regions.size() && _copy_regions[last].source == _copy_regions[first].source && _copy_regions[last].destination == _copy_regions[first].destination)
+        {
+        aligned = aligned && is_word_aligned(_copy_regions[last]);
+        ++last;
+        }
+      uint32_t source_buffer_id = _buffer_objects[_copy_regions[first].source].gl_buffer_id;
+      uint32_t destination_buffer_id = _buffer_objects[_copy_regions[first].destination].gl_buffer_id;
+      // within one buffer a region may read what an earlier one wrote, and the kernel cannot bind it as source and destination
+      bool gather = aligned && last - first >= COPY_GATHER_THRESHOLD && source_buffer_id != destination_buffer_id &&
+        !writes_overlap(_copy_regions.data() + first, last - first, _gather_ranges);
+      if (gather)
+        _gather_copy(source_buffer_id, destination_buffer_id, first, last);
+      else
+        {
+        for (size_t i = first; i < last; ++i)
+          glCopyNamedBufferSubData(source_buffer_id, destination_buffer_id, _copy_regions[i].read_offset, _copy_regions[i].write_offset, _copy_regions[i].size);
+        }
+      first = last;
+      }
     glCheckError();
     }
 
+  void render_context_gl::_gather_copy(uint32_t source_buffer_id, uint32_t destination_buffer_id, size_t first, size_t last)
+    {
+    if (_gather_program_id == 0)
+      {
+      uint32_t shader_id = glCreateShader(GL_COMPUTE_SHADER);
+      glShaderSource(shader_id, 1, &gather_copy_shader, nullptr);
+      glCompileShader(shader_id);
+      int value = 0;
+      glGetShaderiv(shader_id, GL_COMPILE_STATUS, &value);
+      if (!value)
+        throw std::runtime_error("Could not compile the gather copy shader");
+      _gather_program_id = glCreateProgram();
+      glAttachShader(_gather_program_id, shader_id);
+      glLinkProgram(_gather_program_id);
+      glDeleteShader(shader_id);
+      glGetProgramiv(_gather_program_id, GL_LINK_STATUS, &value);
+      if (!value)
+        throw std::runtime_error("Could not link the gather copy shader");
+      glGenBuffers(1, &_gather_buffer_id);
+      }
+    _gather_regions.clear();
+    for (size_t i = first; i < last; ++i)
+      {
+      _gather_regions.push_back(_copy_regions[i].read_offset / 4);
+      _gather_regions.push_back(_copy_regions[i].write_offset / 4);
+      _gather_regions.push_back(_copy_regions[i].size / 4);
+      _gather_regions.push_back(0);
+      }
+    GLsizeiptr size = (GLsizeiptr)(_gather_regions.size() * sizeof(uint32_t));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _gather_buffer_id);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, _gather_regions.data(), GL_STREAM_DRAW);
+    _statistics.bytes_uploaded += (uint64_t)size;
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glUseProgram(_gather_program_id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, source_buffer_id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, destination_buffer_id);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, _gather_buffer_id, 0, size);
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    glDispatchCompute((GLuint)std::min<size_t>(last - first, 65535), 1, 1);
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    glUseProgram((GLuint)program);
+    }
+
   void render_context_gl::get_data_from_buffer_object(int32_t handle, void* data, int32_t size)
     {
     if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
@@ -834,11 +1240,74 @@ namespace RenderDoos
           break;
         }
         */
-      glGetNamedBufferSubData(buf->gl_buffer_id, 0, size, data);
+      glGetNamedBufferSubData(buf->gl_buffer_id, _partition_offset(buf), size, data);
       glCheckError();
       }
     }
 
+  int32_t render_context_gl::readback_buffer_object(int32_t handle, int32_t size, int32_t offset)
+    {
+    if (handle < 0 || handle >= MAX_BUFFER_OBJECT || size <= 0)
+      return -1;
+    buffer_object* buf = &_buffer_objects[handle];
+    if (buf->size == 0)
+      return -1;
+    for (int32_t i = 0; i < MAX_READBACKS; ++i)
+      {
+      readback_handle* rb = &_readbacks[i];
+      if (rb->size > 0)
+        continue;
+      const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      if (rb->capacity < size)
+        {
+        if (rb->gl_buffer_id != 0)
+          {
+          glBindBuffer(GL_COPY_WRITE_BUFFER, rb->gl_buffer_id);
+          glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+          glDeleteBuffers(1, &rb->gl_buffer_id);
+          }
+        glGenBuffers(1, &rb->gl_buffer_id);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, rb->gl_buffer_id);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+        rb->mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+        glCheckError();
+        if (!rb->mapped)
+          throw std::runtime_error("Could not map readback buffer");
+        rb->capacity = size;
+        }
+      glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT); // shader writes before the copy
+      glCopyNamedBufferSubData(buf->gl_buffer_id, rb->gl_buffer_id, _partition_offset(buf) + offset, 0, size);
+      rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      glFlush(); // so that the fence signals without a later wait flushing it
+      rb->size = size;
+      glCheckError();
+      return i;
+      }
+    return -1;
+    }
+
+  bool render_context_gl::is_readback_ready(int32_t readback)
+    {
+    if (readback < 0 || readback >= MAX_READBACKS || _readbacks[readback].size == 0)
+      return false;
+    GLenum result = glClientWaitSync((GLsync)_readbacks[readback].fence, 0, 0);
+    return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+    }
+
+  void render_context_gl::finish_readback(int32_t readback, void* data)
+    {
+    if (readback < 0 || readback >= MAX_READBACKS || _readbacks[readback].size == 0)
+      return;
+    readback_handle* rb = &_readbacks[readback];
+    GLsync fence = (GLsync)rb->fence;
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+      ;
+    glDeleteSync(fence);
+    memcpy(data, rb->mapped, rb->size);
+    rb->fence = nullptr;
+    rb->size = 0;
+    }
+
   void render_context_gl::_remove_buffer_object(geometry_ref& ref)
     {
     if (ref.buffer < 0 || ref.buffer >= MAX_BUFFER_OBJECT)
@@ -846,13 +1315,15 @@ namespace RenderDoos
     buffer_object* buf = &_buffer_objects[ref.buffer];
     if (buf->size > 0)
       {
-      delete[] buf->raw;
+      _free_host_memory(buf);
       glDeleteBuffers(1, &buf->gl_buffer_id);
       glCheckError();
       }
     buf->size = 0;
     buf->raw = nullptr;
     buf->type = 0;
+    buf->flags = 0;
+    buf->mapped = nullptr;
     ref.count = 0;
     }
 
@@ -867,6 +1338,15 @@ namespace RenderDoos
     geo->mode = 0;
     glDeleteVertexArrays(1, &geo->gl_vertex_array_object_id);
     glCheckError();
+    _remove_submeshes(handle);
+    if (geo->flags & GEOMETRY_POOLED) // the pool buffers stay
+      {
+      _release_pooled(geo->vertex);
+      _release_pooled(geo->index);
+      return;
+      }
+    if (geo->flags & GEOMETRY_EXTERNAL_BUFFERS) // the compute buffers belong to the caller
+      return;
     _remove_buffer_object(geo->vertex);
     _remove_buffer_object(geo->index);
     }
@@ -899,30 +1379,150 @@ namespace RenderDoos
         glGenBuffers(1, &buf->gl_buffer_id);
         glCheckError();
         }
-      if (buf->raw)
-        {
-        delete[] buf->raw;
-        }
-      buf->raw = new uint8_t[size];
+      _allocate_host_memory(buf, size);
       buf->size = size;
       buf->type = type;
-      ref.count = count;
       glBindBuffer(type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER, buf->gl_buffer_id);
-      glBufferData(type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+      glBufferData(type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER, padded_geometry_size(size), nullptr, GL_DYNAMIC_DRAW);
       glCheckError();
+      ref.number_of_dirty_ranges = -1; // new storage, everything has to be sent
       }
+    else
+      ref.number_of_dirty_ranges = 0;
+    ref.count = count;
     if (pointer)
       {
       *pointer = (void*)buf->raw;
       }
     }
 
+  void render_context_gl::_allocate_streaming_buffer_object(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer)
+    {
+    assert(type == GEOMETRY_VERTEX || type == GEOMETRY_INDEX);
+    if (ref.buffer < 0) // no actual buffer assigned yet
+      {
+      buffer_object* buf = _buffer_objects;
+      for (int32_t i = 0; i < MAX_BUFFER_OBJECT; ++i)
+        {
+        if (buf->size == 0)
+          {
+          ref.buffer = i;
+          buf->type = 0;
+          break;
+          }
+        ++buf;
+        }
+      if (ref.buffer < 0) // all buffers are used
+        throw std::runtime_error("Out of memory");
+      }
+    buffer_object* buf = &_buffer_objects[ref.buffer];
+    int32_t size = tuple_size * count;
+    if (buf->size < size || (buf->type != type))
+      {
+      if (buf->size != 0)
+        glDeleteBuffers(1, &buf->gl_buffer_id);
+      glGenBuffers(1, &buf->gl_buffer_id);
+      buf->size = size;
+      buf->type = type;
+      buf->flags = BUFFER_STREAMING;
+      _create_streaming_storage(buf, type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER);
+      }
+    ref.count = count;
+    ref.number_of_dirty_ranges = 0;
+    uint8_t* partition = _streaming_partition(buf);
+    if (pointer)
+      {
+      *pointer = (void*)partition;
+      }
+    }
+
+  void render_context_gl::_allocate_mapped_buffer_object(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer)
+    {
+    assert(type == GEOMETRY_VERTEX || type == GEOMETRY_INDEX);
+    if (ref.buffer < 0) // no actual buffer assigned yet
+      {
+      buffer_object* buf = _buffer_objects;
+      for (int32_t i = 0; i < MAX_BUFFER_OBJECT; ++i)
+        {
+        if (buf->size == 0)
+          {
+          ref.buffer = i;
+          buf->type = 0;
+          break;
+          }
+        ++buf;
+        }
+      if (ref.buffer < 0) // all buffers are used
+        throw std::runtime_error("Out of memory");
+      }
+    buffer_object* buf = &_buffer_objects[ref.buffer];
+    int32_t size = tuple_size * count;
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+    if (buf->size < size || (buf->type != type))
+      {
+      if (buf->size == 0) // first initialization
+        {
+        glGenBuffers(1, &buf->gl_buffer_id);
+        glCheckError();
+        }
+      buf->size = size;
+      buf->type = type;
+      glBindBuffer(type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER, buf->gl_buffer_id);
+      glBufferData(type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER, padded_geometry_size(size), nullptr, GL_DYNAMIC_DRAW);
+      access |= GL_MAP_INVALIDATE_BUFFER_BIT;
+      ref.number_of_dirty_ranges = -1; // new storage, everything has to be written
+      }
+    else
+      ref.number_of_dirty_ranges = 0;
+    ref.count = count;
+    buf->mapped = size > 0 ? (uint8_t*)glMapNamedBufferRange(buf->gl_buffer_id, 0, size, access) : nullptr;
+    glCheckError();
+    if (pointer)
+      {
+      *pointer = (void*)buf->mapped;
+      }
+    }
+
+  void render_context_gl::_unmap_buffer_object(geometry_ref& ref, int32_t size)
+    {
+    if (ref.buffer < 0)
+      return;
+    buffer_object* buf = &_buffer_objects[ref.buffer];
+    if (!buf->mapped)
+      return;
+    if (ref.number_of_dirty_ranges > 0)
+      {
+      for (int32_t i = 0; i < ref.number_of_dirty_ranges; ++i)
+        {
+        int32_t offset = ref.dirty_ranges[i].offset < 0 ? 0 : ref.dirty_ranges[i].offset;
+        int32_t end = ref.dirty_ranges[i].offset + ref.dirty_ranges[i].size;
+        if (end > size)
+          end = size;
+        if (end <= offset)
+          continue;
+        glFlushMappedNamedBufferRange(buf->gl_buffer_id, offset, end - offset);
+        _statistics.bytes_uploaded += end - offset;
+        }
+      }
+    else
+      {
+      glFlushMappedNamedBufferRange(buf->gl_buffer_id, 0, size);
+      _statistics.bytes_uploaded += size;
+      }
+    ref.number_of_dirty_ranges = 0;
+    buf->mapped = nullptr;
+    GLboolean intact = glUnmapNamedBuffer(buf->gl_buffer_id);
+    glCheckError();
+    if (intact == GL_FALSE)
+      throw std::runtime_error("Geometry buffer got corrupted while it was mapped");
+    }
+
   void render_context_gl::geometry_begin(int32_t handle, int32_t number_of_vertices, int32_t number_of_indices, float** vertex_pointer, void** index_pointer, int32_t update)
     {
     if (handle < 0 || handle >= MAX_GEOMETRY)
       return;
     geometry_handle* gh = &_geometry_handles[handle];
-    if (gh->mode == 0)
+    if (gh->mode == 0 || (gh->flags & GEOMETRY_EXTERNAL_BUFFERS))
       return;
     if (vertex_pointer)
       *vertex_pointer = 0;
@@ -932,23 +1532,113 @@ namespace RenderDoos
     if ((update & GEOMETRY_VERTEX) && !(gh->locked & GEOMETRY_VERTEX)) // vertices
       {
       gh->locked |= GEOMETRY_VERTEX;
-      _allocate_buffer_object(gh->vertex, gh->vertex_size, number_of_vertices, GEOMETRY_VERTEX, (void**)vertex_pointer);
+      if (gh->flags & GEOMETRY_STREAMING)
+        _allocate_streaming_buffer_object(gh->vertex, gh->vertex_size, number_of_vertices, GEOMETRY_VERTEX, (void**)vertex_pointer);
+      else if (gh->flags & GEOMETRY_ZERO_COPY)
+        _allocate_mapped_buffer_object(gh->vertex, gh->vertex_size, number_of_vertices, GEOMETRY_VERTEX, (void**)vertex_pointer);
+      else if (gh->flags & GEOMETRY_POOLED)
+        {
+        uint8_t* pointer = _allocate_pooled(gh->vertex, _get_geometry_pool(gh, GEOMETRY_VERTEX), number_of_vertices, GEOMETRY_VERTEX);
+        if (vertex_pointer)
+          *vertex_pointer = (float*)pointer;
+        }
+      else
+        _allocate_buffer_object(gh->vertex, gh->vertex_size, number_of_vertices, GEOMETRY_VERTEX, (void**)vertex_pointer);
       }
     if ((update & GEOMETRY_INDEX) && !(gh->locked & GEOMETRY_INDEX)) // indices
       {
       gh->locked |= GEOMETRY_INDEX;
-      _allocate_buffer_object(gh->index, sizeof(uint32_t), number_of_indices, GEOMETRY_INDEX, (void**)index_pointer);
+      int32_t previous_index_size = gh->index_size;
+      gh->index_size = _get_index_size(gh, (update & GEOMETRY_VERTEX) ? number_of_vertices : gh->vertex.count);
+      int32_t user_index_size = gh->index_type == INDEX_TYPE_AUTO ? sizeof(uint32_t) : gh->index_size;
+      if (gh->flags & (GEOMETRY_STREAMING | GEOMETRY_ZERO_COPY))
+        {
+        bool staging = user_index_size != gh->index_size; // the user writes 32-bit indices to a staging block that geometry_end narrows into gpu memory
+        if (gh->flags & GEOMETRY_STREAMING)
+          _allocate_streaming_buffer_object(gh->index, gh->index_size, number_of_indices, GEOMETRY_INDEX, staging ? nullptr : (void**)index_pointer);
+        else
+          _allocate_mapped_buffer_object(gh->index, gh->index_size, number_of_indices, GEOMETRY_INDEX, staging ? nullptr : (void**)index_pointer);
+        if (staging)
+          {
+          buffer_object* buf = &_buffer_objects[gh->index.buffer];
+          _allocate_host_memory(buf, number_of_indices * user_index_size);
+          if (index_pointer)
+            *index_pointer = (void*)buf->raw;
+          }
+        }
+      else if (gh->flags & GEOMETRY_POOLED)
+        {
+        uint8_t* pointer = _allocate_pooled(gh->index, _get_geometry_pool(gh, GEOMETRY_INDEX), number_of_indices, GEOMETRY_INDEX);
+        if (user_index_size != gh->index_size) // the pool holds 16-bit indices, so the user writes to a staging block
+          {
+          gh->index_staging = new uint8_t[number_of_indices * user_index_size];
+          _statistics.host_memory += number_of_indices * user_index_size;
+          pointer = gh->index_staging;
+          }
+        if (index_pointer)
+          *index_pointer = (void*)pointer;
+        }
+      else
+        _allocate_buffer_object(gh->index, user_index_size, number_of_indices, GEOMETRY_INDEX, (void**)index_pointer);
+      if (gh->index_size != previous_index_size)
+        gh->index.number_of_dirty_ranges = -1;
       }
     }
 
-  void render_context_gl::_update_buffer_object(geometry_ref& ref)
+  void render_context_gl::_update_buffer_object(geometry_ref& ref, int32_t element_size)
     {
     if (ref.buffer < 0)
       return;
     buffer_object* buf = &_buffer_objects[ref.buffer];
-    glBindBuffer(buf->type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER, buf->gl_buffer_id);
-    glBufferData(buf->type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER, buf->size, nullptr, GL_DYNAMIC_DRAW);
-    glBufferSubData(buf->type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER, 0, buf->size, buf->raw);
+    int32_t size = ref.count * element_size;
+    int32_t base = ref.offset * element_size; // start of the range of a pooled geometry
+    GLenum target = buf->type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER;
+    glBindBuffer(target, buf->gl_buffer_id);
+    if (ref.number_of_dirty_ranges > 0) // only the changed bytes, without orphaning the buffer
+      {
+      for (int32_t i = 0; i < ref.number_of_dirty_ranges; ++i)
+        {
+        int32_t offset = ref.dirty_ranges[i].offset < 0 ? 0 : ref.dirty_ranges[i].offset;
+        int32_t end = ref.dirty_ranges[i].offset + ref.dirty_ranges[i].size;
+        if (end > size)
+          end = size;
+        if (end <= offset)
+          continue;
+        glBufferSubData(target, base + offset, end - offset, buf->raw + base + offset);
+        _statistics.bytes_uploaded += end - offset;
+        }
+      }
+    else if (buf->flags & BUFFER_POOLED) // other geometries live in the same buffer, so it cannot be orphaned
+      {
+      glBufferSubData(target, base, size, buf->raw + base);
+      _statistics.bytes_uploaded += size;
+      }
+    else
+      {
+      glBufferData(target, padded_geometry_size(buf->size), nullptr, GL_DYNAMIC_DRAW);
+      glBufferSubData(target, 0, size, buf->raw);
+      _statistics.bytes_uploaded += size;
+      }
+    ref.number_of_dirty_ranges = 0;
+    glCheckError();
+    }
+
+  void render_context_gl::_update_geometry_pool(buffer_object* buf, int32_t size)
+    {
+    GLenum target = buf->type == GEOMETRY_VERTEX ? GL_ARRAY_BUFFER : GL_ELEMENT_ARRAY_BUFFER;
+    if (buf->size == 0) // first initialization
+      glGenBuffers(1, &buf->gl_buffer_id);
+    glBindBuffer(target, buf->gl_buffer_id);
+    if (buf->size != buf->raw_size) // the pool grew
+      {
+      glBufferData(target, padded_geometry_size(buf->raw_size), nullptr, GL_DYNAMIC_DRAW);
+      buf->size = buf->raw_size;
+      }
+    if (size > 0)
+      {
+      glBufferSubData(target, 0, size, buf->raw);
+      _statistics.bytes_uploaded += size;
+      }
     glCheckError();
     }
 
@@ -959,71 +1649,375 @@ namespace RenderDoos
     geometry_handle* gh = &_geometry_handles[handle];
     if (gh->mode == 0)
       return;
+    if (gh->flags & GEOMETRY_STREAMING) // the data is already in the ring, the mapping is coherent
+      {
+      if ((gh->locked & GEOMETRY_INDEX) && gh->index.buffer >= 0 && _buffer_objects[gh->index.buffer].raw)
+        {
+        buffer_object* buf = &_buffer_objects[gh->index.buffer];
+        _narrow_indices(gh, buf->mapped + _partition_offset(buf));
+        _free_host_memory(buf);
+        }
+      if (gh->locked & GEOMETRY_VERTEX)
+        _statistics.bytes_uploaded += gh->vertex.count * gh->vertex_size;
+      if (gh->locked & GEOMETRY_INDEX)
+        _statistics.bytes_uploaded += gh->index.count * gh->index_size;
+      gh->locked &= ~(GEOMETRY_VERTEX | GEOMETRY_INDEX);
+      return;
+      }
+    if (gh->flags & GEOMETRY_ZERO_COPY)
+      {
+      if (gh->locked & GEOMETRY_VERTEX)
+        _unmap_buffer_object(gh->vertex, gh->vertex.count * gh->vertex_size);
+      if ((gh->locked & GEOMETRY_INDEX) && gh->index.buffer >= 0)
+        {
+        buffer_object* buf = &_buffer_objects[gh->index.buffer];
+        if (buf->raw)
+          {
+          _narrow_indices(gh, buf->mapped);
+          _free_host_memory(buf);
+          }
+        _unmap_buffer_object(gh->index, gh->index.count * gh->index_size);
+        }
+      gh->locked &= ~(GEOMETRY_VERTEX | GEOMETRY_INDEX);
+      return;
+      }
     if (gh->locked & GEOMETRY_VERTEX)
       {
-      _update_buffer_object(gh->vertex);
+      _update_buffer_object(gh->vertex, gh->vertex_size);
       gh->locked &= ~GEOMETRY_VERTEX;
       }
     if (gh->locked & GEOMETRY_INDEX)
       {
-      _update_buffer_object(gh->index);
+      _narrow_indices(gh);
+      _update_buffer_object(gh->index, gh->index_size);
       gh->locked &= ~GEOMETRY_INDEX;
       }
     }
 
   void render_context_gl::geometry_draw(int32_t handle, int32_t instance_count)
+    {
+    if (handle < 0 || handle >= MAX_GEOMETRY)
+      return;
+    _geometry_draw(handle, 0, _geometry_handles[handle].index.count, 0, instance_count);
+    }
+
+  void render_context_gl::_geometry_draw(int32_t handle, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance)
     {
     if (handle < 0 || handle >= MAX_GEOMETRY)
       return;
     geometry_handle* gh = &_geometry_handles[handle];
     if (gh->mode == 0)
       return;
+    _draw_geometry(gh, first_index, index_count, base_vertex, instance_count, base_instance);
+    }
+
+  void render_context_gl::transient_geometry_draw(const transient_geometry& tg, int32_t instance_count)
+    {
+    geometry_handle* gh = _get_transient_handle(tg);
+    if (!gh)
+      return;
+    if (gh->gl_vertex_array_object_id == 0) // once per vertex layout
+      glGenVertexArrays(1, &gh->gl_vertex_array_object_id);
+    _draw_geometry(gh, 0, tg.number_of_indices, 0, instance_count, 0);
+    }
+
+  void render_context_gl::_draw_geometry(const geometry_handle* gh, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance)
+    {
+    if (gh->flags & GEOMETRY_VERTEX_PULLING)
+      {
+      _geometry_draw_vertex_pulling(gh, first_index, index_count, base_vertex, instance_count, base_instance);
+      return;
+      }
+    intptr_t index_offset = _bind_geometry(gh);
+    GLenum index_type = gh->index_size == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    const void* indices = reinterpret_cast<const void*>(index_offset + (intptr_t)(gh->index.offset + first_index) * gh->index_size); // pooled geometry adds its own first index and base vertex
+    if (instance_count < 2 && base_instance == 0)
+      glDrawElementsBaseVertex(GL_TRIANGLES, index_count, index_type, indices, gh->vertex.offset + base_vertex);
+    else
+      glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, index_count, index_type, indices, instance_count < 1 ? 1 : instance_count, gh->vertex.offset + base_vertex, base_instance);
+    ++_statistics.draw_calls;
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glCheckError();
+    }
+
+  void render_context_gl::geometry_draw_batch(const draw_command* commands, int32_t number_of_commands)
+    {
+    int32_t i = 0;
+    while (i < number_of_commands)
+      {
+      const draw_command& command = commands[i];
+      if (command.geometry < 0 || command.geometry >= MAX_GEOMETRY || _geometry_handles[command.geometry].mode == 0)
+        {
+        ++i;
+        continue;
+        }
+      const geometry_handle* gh = &_geometry_handles[command.geometry];
+      if (gh->flags & GEOMETRY_VERTEX_PULLING) // the draw constants are set per draw
+        {
+        int32_t first_index = command.first_index;
+        int32_t index_count = command.index_count;
+        if (_clip_index_range(gh, first_index, index_count))
+          _geometry_draw(command.geometry, first_index, index_count, command.base_vertex, command.instance_count, command.base_instance);
+        ++i;
+        continue;
+        }
+      int32_t end = i + 1;
+      while (end < number_of_commands && _shares_draw_state(gh, commands[end].geometry))
+        ++end;
+      if (end == i + 1) // nothing to merge, skip the indirect buffer
+        {
+        int32_t first_index = command.first_index;
+        int32_t index_count = command.index_count;
+        if (_clip_index_range(gh, first_index, index_count))
+          _geometry_draw(command.geometry, first_index, index_count, command.base_vertex, command.instance_count, command.base_instance);
+        ++i;
+        continue;
+        }
+      intptr_t index_offset = _bind_geometry(gh);
+      _indirect_commands.clear();
+      for (int32_t j = i; j < end; ++j)
+        {
+        const geometry_handle* other = &_geometry_handles[commands[j].geometry];
+        int32_t first_index = commands[j].first_index;
+        int32_t index_count = commands[j].index_count;
+        if (!_clip_index_range(other, first_index, index_count))
+          continue;
+        _indirect_commands.push_back((uint32_t)index_count);
+        _indirect_commands.push_back((uint32_t)(commands[j].instance_count < 1 ? 1 : commands[j].instance_count));
+        _indirect_commands.push_back((uint32_t)(index_offset / other->index_size + other->index.offset + first_index));
+        _indirect_commands.push_back((uint32_t)(other->vertex.offset + commands[j].base_vertex));
+        _indirect_commands.push_back((uint32_t)commands[j].base_instance);
+        }
+      if (!_indirect_commands.empty())
+        {
+        // the commands of the multi draws of a frame are appended to a persistently mapped ring
+        int32_t size = (int32_t)(_indirect_commands.size() * sizeof(uint32_t));
+        if (_indirect_frame != _frame_index)
+          {
+          _indirect_frame = _frame_index;
+          _indirect_cursor = 0;
+          }
+        if (_indirect_buffer < 0 || _indirect_cursor + size > _buffer_objects[_indirect_buffer].size)
+          {
+          int32_t capacity = _indirect_buffer < 0 ? 0 : _buffer_objects[_indirect_buffer].size;
+          if (_indirect_buffer >= 0) // earlier multi draws of this frame keep the old ring alive until the gpu is done
+            remove_deferred(RESOURCE_BUFFER_OBJECT, _indirect_buffer);
+          capacity = std::max(std::max(2 * capacity, _indirect_cursor + size), 4096);
+          _indirect_buffer = add_buffer_object(nullptr, capacity, COMPUTE_BUFFER | BUFFER_STREAMING);
+          _indirect_cursor = 0;
+          if (_indirect_buffer < 0)
+            throw std::runtime_error("Out of buffer objects for the multi draw commands");
+          }
+        update_buffer_object(_indirect_buffer, _indirect_commands.data(), size, _indirect_cursor);
+        const buffer_object* buf = &_buffer_objects[_indirect_buffer];
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buf->gl_buffer_id);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, gh->index_size == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(intptr_t)(_partition_offset(buf) + _indirect_cursor), (GLsizei)(_indirect_commands.size() / 5), 0);
+        _indirect_cursor += size;
+        ++_statistics.draw_calls;
+        }
+      i = end;
+      }
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glCheckError();
+    }
+
+  void render_context_gl::geometry_draw_indirect(int32_t geometry, int32_t command_buffer, int32_t count_buffer, int32_t max_commands)
+    {
+    if (geometry < 0 || geometry >= MAX_GEOMETRY || command_buffer < 0 || command_buffer >= MAX_BUFFER_OBJECT)
+      return;
+    const geometry_handle* gh = &_geometry_handles[geometry];
+    const buffer_object* commands = &_buffer_objects[command_buffer];
+    if (gh->mode == 0 || (gh->flags & GEOMETRY_VERTEX_PULLING) || commands->size == 0)
+      return;
+    if (max_commands * (int32_t)sizeof(draw_indirect_command) > commands->size)
+      max_commands = commands->size / (int32_t)sizeof(draw_indirect_command);
+    intptr_t index_offset = _bind_geometry(gh);
+    if (index_offset != 0) // the first indices of the commands cannot include the offset of the index buffer
+      throw std::runtime_error("Indirect draws need an index buffer that starts at offset 0, not streaming or suballocated");
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT); // the commands and the count were written by a compute shader
+    GLenum index_type = gh->index_size == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands->gl_buffer_id);
+    if (count_buffer >= 0 && count_buffer < MAX_BUFFER_OBJECT && _buffer_objects[count_buffer].size > 0 && glMultiDrawElementsIndirectCountARB)
+      {
+      glBindBuffer(GL_PARAMETER_BUFFER_ARB, _buffer_objects[count_buffer].gl_buffer_id);
+      glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, index_type, (const void*)(intptr_t)_partition_offset(commands), _partition_offset(&_buffer_objects[count_buffer]), max_commands, 0);
+      glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+      }
+    else // the commands past the count have an instance count of 0 (see gpu_culling)
+      glMultiDrawElementsIndirect(GL_TRIANGLES, index_type, (const void*)(intptr_t)_partition_offset(commands), max_commands, 0);
+    ++_statistics.draw_calls;
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glCheckError();
+    }
+
+  bool render_context_gl::_shares_draw_state(const geometry_handle* gh, int32_t handle) const
+    {
+    if (handle < 0 || handle >= MAX_GEOMETRY)
+      return false;
+    const geometry_handle* other = &_geometry_handles[handle];
+    if (other->mode == 0 || (other->flags & GEOMETRY_VERTEX_PULLING))
+      return false;
+    if (other->vertex.buffer != gh->vertex.buffer || other->index.buffer != gh->index.buffer || other->index_size != gh->index_size)
+      return false;
+    if (other->vertex_declaration_type != gh->vertex_declaration_type)
+      return false;
+    if (other->instance_buffer != gh->instance_buffer || (gh->instance_buffer >= 0 && other->instance_layout != gh->instance_layout))
+      return false;
+    if (gl_buffer_declaration_table[gh->vertex_declaration_type].quantized && // the quantization constants are not per draw
+      (memcmp(other->quantization_offset, gh->quantization_offset, sizeof(gh->quantization_offset)) != 0 || memcmp(other->quantization_extent, gh->quantization_extent, sizeof(gh->quantization_extent)) != 0))
+      return false;
+    return true;
+    }
+
+  intptr_t render_context_gl::_bind_geometry(const geometry_handle* gh)
+    {
+    if (gh->flags & GEOMETRY_EXTERNAL_BUFFERS) // the buffers may have been written by a compute shader
+      glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
     glBindVertexArray(gh->gl_vertex_array_object_id);
     glCheckError();
 
+    intptr_t vertex_offset = 0; // offsets of the latest ring partitions for streaming geometry
+    intptr_t index_offset = 0;
     if (gh->vertex.buffer >= 0 && gh->vertex.buffer < MAX_BUFFER_OBJECT)
       {
       buffer_object* buf = &_buffer_objects[gh->vertex.buffer];
       glBindBuffer(GL_ARRAY_BUFFER, buf->gl_buffer_id);
+      vertex_offset = _partition_offset(buf);
       }
     if (gh->index.buffer >= 0 && gh->index.buffer < MAX_BUFFER_OBJECT)
       {
       buffer_object* buf = &_buffer_objects[gh->index.buffer];
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf->gl_buffer_id);
+      index_offset = _partition_offset(buf);
       }
     gl_buffer_declaration* decl = gl_buffer_declaration_table[gh->vertex_declaration_type].declaration;
     while (decl->stride)
       {
       glEnableVertexAttribArray(decl->location);
-      switch (decl->type)
+      if (decl->normalized)
+        glVertexAttribPointer(decl->location, decl->tupleSize, decl->type, GL_TRUE, decl->stride, reinterpret_cast<const void*>(vertex_offset + decl->offset));
+      else
         {
-        case GL_UNSIGNED_BYTE:
-        case GL_BYTE:
-        case GL_UNSIGNED_SHORT:
-        case GL_SHORT:
-        case GL_UNSIGNED_INT:
-        case GL_INT:
-          glVertexAttribIPointer(decl->location, decl->tupleSize, decl->type, decl->stride, reinterpret_cast<const void*>(intptr_t(decl->offset)));
-          break;
-        default:
-          glVertexAttribPointer(decl->location, decl->tupleSize, decl->type, GL_FALSE, decl->stride, reinterpret_cast<const void*>(intptr_t(decl->offset)));
-          break;
+        switch (decl->type)
+          {
+          case GL_UNSIGNED_BYTE:
+          case GL_BYTE:
+          case GL_UNSIGNED_SHORT:
+          case GL_SHORT:
+          case GL_UNSIGNED_INT:
+          case GL_INT:
+            glVertexAttribIPointer(decl->location, decl->tupleSize, decl->type, decl->stride, reinterpret_cast<const void*>(vertex_offset + decl->offset));
+            break;
+          default:
+            glVertexAttribPointer(decl->location, decl->tupleSize, decl->type, GL_FALSE, decl->stride, reinterpret_cast<const void*>(vertex_offset + decl->offset));
+            break;
+          }
         }
       ++decl;
       }
+    if (gl_buffer_declaration_table[gh->vertex_declaration_type].quantized)
+      {
+      glVertexAttrib3fv(QUANTIZATION_OFFSET_LOCATION, gh->quantization_offset);
+      glVertexAttrib3fv(QUANTIZATION_EXTENT_LOCATION, gh->quantization_extent);
+      }
+    _bind_instance_attributes(gh);
     glCheckError();
 
     if (m_current_renderpass_descriptor.depth_texture_handle >= 0)
       glEnable(GL_DEPTH_TEST);
     else
       glDisable(GL_DEPTH_TEST);
-    if (instance_count < 2)
-      glDrawElements(GL_TRIANGLES, gh->index.count, GL_UNSIGNED_INT, 0);
+    return index_offset;
+    }
+
+  void render_context_gl::_bind_instance_attributes(const geometry_handle* gh)
+    {
+    const buffer_object* buf = gh->instance_buffer >= 0 ? &_buffer_objects[gh->instance_buffer] : nullptr;
+    if (!buf || buf->size == 0)
+      {
+      for (int32_t location = INSTANCE_MODEL_LOCATION; location <= INSTANCE_EXTRA_LOCATION; ++location)
+        glDisableVertexAttribArray(location);
+      return;
+      }
+    glBindBuffer(GL_ARRAY_BUFFER, buf->gl_buffer_id);
+    intptr_t offset = _partition_offset(buf);
+    int32_t stride = _get_instance_size(gh->instance_layout);
+    for (int32_t column = 0; column < 4; ++column)
+      {
+      glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + column);
+      glVertexAttribPointer(INSTANCE_MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(offset + column * sizeof(float4)));
+      glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + column, 1);
+      }
+    switch (gh->instance_layout)
+      {
+      case INSTANCE_MATRIX_COLOR:
+        glEnableVertexAttribArray(INSTANCE_EXTRA_LOCATION);
+        glVertexAttribIPointer(INSTANCE_EXTRA_LOCATION, 1, GL_UNSIGNED_INT, stride, reinterpret_cast<const void*>(offset + sizeof(float4x4)));
+        glVertexAttribDivisor(INSTANCE_EXTRA_LOCATION, 1);
+        break;
+      case INSTANCE_MATRIX_DATA:
+        glEnableVertexAttribArray(INSTANCE_EXTRA_LOCATION);
+        glVertexAttribPointer(INSTANCE_EXTRA_LOCATION, 4, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(offset + sizeof(float4x4)));
+        glVertexAttribDivisor(INSTANCE_EXTRA_LOCATION, 1);
+        break;
+      default:
+        glDisableVertexAttribArray(INSTANCE_EXTRA_LOCATION);
+        break;
+      }
+    }
+
+  void render_context_gl::_bind_vertex_pulling_buffer(int32_t handle, int32_t channel)
+    {
+    buffer_object* buf = &_buffer_objects[handle];
+    if (buf->flags & BUFFER_STREAMING)
+      glBindBufferRange(GL_SHADER_STORAGE_BUFFER, channel, buf->gl_buffer_id, _partition_offset(buf), buf->stride);
     else
-      glDrawElementsInstanced(GL_TRIANGLES, gh->index.count, GL_UNSIGNED_INT, 0, instance_count);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, channel, buf->gl_buffer_id);
+    }
+
+  void render_context_gl::_geometry_draw_vertex_pulling(const geometry_handle* gh, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance)
+    {
+    if (gh->vertex.buffer < 0 || gh->index.buffer < 0)
+      return;
+    if (_vertex_pulling_vertex_array_object_id == 0) // core profile needs a vertex array object, even without attributes
+      glGenVertexArrays(1, &_vertex_pulling_vertex_array_object_id);
+    glBindVertexArray(_vertex_pulling_vertex_array_object_id);
+    if (gh->flags & GEOMETRY_EXTERNAL_BUFFERS) // the buffers may have been written by a compute shader
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    _bind_vertex_pulling_buffer(gh->vertex.buffer, VERTEX_PULLING_VERTEX_CHANNEL);
+    _bind_vertex_pulling_buffer(gh->index.buffer, VERTEX_PULLING_INDEX_CHANNEL);
+    glVertexAttribI4i(VERTEX_PULLING_LOCATION, gh->index.offset + first_index, gh->vertex.offset + base_vertex, gh->index_size, gh->vertex_size / 4);
+    if (gl_buffer_declaration_table[gh->vertex_declaration_type].quantized)
+      {
+      glVertexAttrib3fv(QUANTIZATION_OFFSET_LOCATION, gh->quantization_offset);
+      glVertexAttrib3fv(QUANTIZATION_EXTENT_LOCATION, gh->quantization_extent);
+      }
+    _bind_instance_attributes(gh);
+    glCheckError();
+
+    if (m_current_renderpass_descriptor.depth_texture_handle >= 0)
+      glEnable(GL_DEPTH_TEST);
+    else
+      glDisable(GL_DEPTH_TEST);
+    if (instance_count < 2 && base_instance == 0)
+      glDrawArrays(GL_TRIANGLES, 0, index_count);
+    else
+      glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, index_count, instance_count < 1 ? 1 : instance_count, base_instance);
+    ++_statistics.draw_calls;
 
     glBindVertexArray(0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     glCheckError();
@@ -2,6 +2,7 @@
 
 #include "render_context.h"
 #include <mutex>
+#include <vector>
 
 namespace RenderDoos
   {
@@ -12,6 +13,8 @@ namespace RenderDoos
       render_context_gl();
       ~render_context_gl();
 
+      virtual void destroy();
+
       virtual void frame_begin(render_drawables drawables);
       virtual void frame_end(bool wait_until_completed);
       
@@ -37,7 +40,7 @@ namespace RenderDoos
       virtual void get_data_from_texture(int32_t handle, void* data, int32_t size);
       virtual void copy_texture_data(int32_t source_handle, int32_t destination_handle);
 
-      virtual int32_t add_geometry(int32_t vertex_declaration_type); // VERTEX_STANDARD or VERTEX_COMPACT or VERTEX_COLOR
+      virtual int32_t add_geometry(int32_t vertex_declaration_type, int32_t index_type = INDEX_TYPE_32, int32_t geometry_flags = 0); // VERTEX_STANDARD or VERTEX_COMPACT or VERTEX_COLOR
       virtual void remove_geometry(int32_t handle);
 
       virtual int32_t add_render_buffer();
@@ -48,8 +51,14 @@ namespace RenderDoos
       virtual void update_buffer_object(int32_t handle, const void* data, int32_t size, int32_t offset);
       virtual void bind_buffer_object(int32_t handle, int32_t channel, int32_t target);
       virtual void get_data_from_buffer_object(int32_t handle, void* data, int32_t size);
+      virtual int32_t readback_buffer_object(int32_t handle, int32_t size, int32_t offset = 0);
+      virtual bool is_readback_ready(int32_t readback);
+      virtual void finish_readback(int32_t readback, void* data);
       virtual const buffer_object* get_buffer_object(int32_t handle) const;
       virtual void copy_buffer_object_data(int32_t source_handle, int32_t destination_handle, uint32_t read_offset, uint32_t write_offset, uint32_t size);
+      virtual void reserve_buffer_object(int32_t handle, int32_t capacity);
+      virtual void shrink_buffer_object(int32_t handle);
+      virtual void copy_buffer_object_regions(const buffer_copy_region* regions, int32_t number_of_regions); // a gather kernel uses storage buffer channels 0 to 2
 
       virtual void dispatch_compute(int32_t num_groups_x, int32_t num_groups_y, int32_t num_groups_z, int32_t local_size_x, int32_t local_size_y, int32_t local_size_z);
 
@@ -60,6 +69,9 @@ namespace RenderDoos
       virtual void geometry_begin(int32_t handle, int32_t number_of_vertices, int32_t number_of_indices, float** vertex_pointer, void** index_pointer, int32_t update = 3);
       virtual void geometry_end(int32_t handle);
       virtual void geometry_draw(int32_t handle, int32_t instance_count);
+      virtual void geometry_draw_batch(const draw_command* commands, int32_t number_of_commands);
+      virtual void transient_geometry_draw(const transient_geometry& tg, int32_t instance_count = 1);
+      virtual void geometry_draw_indirect(int32_t geometry, int32_t command_buffer, int32_t count_buffer, int32_t max_commands);
 
       virtual int32_t add_shader(const char* source, int32_t type, const char* name);
       virtual void remove_shader(int32_t handle);
@@ -89,17 +101,48 @@ namespace RenderDoos
       void _bind_screen();
 
       void _allocate_buffer_object(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer);
-      void _update_buffer_object(geometry_ref& ref); // send cpu memory to gpu
+      void _allocate_streaming_buffer_object(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer); // pointer goes to the ring partition of the current frame
+      void _allocate_mapped_buffer_object(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer); // pointer goes to mapped gpu memory
+      void _unmap_buffer_object(geometry_ref& ref, int32_t size); // flushes the dirty ranges or the first size bytes
+      void _create_streaming_storage(buffer_object* buf, uint32_t target); // persistently mapped storage for MAX_FRAMES_IN_FLIGHT partitions
+      void _update_buffer_object(geometry_ref& ref, int32_t element_size); // send the count elements of cpu memory to gpu
+      virtual void _update_geometry_pool(buffer_object* buf, int32_t size);
+      virtual void _geometry_draw(int32_t handle, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance = 0);
+      void _draw_geometry(const geometry_handle* gh, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance);
+      void _geometry_draw_vertex_pulling(const geometry_handle* gh, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance); // draws without input assembly state
+      intptr_t _bind_geometry(const geometry_handle* gh); // vertex array object, attributes and depth state, returns the byte offset of the indices
+      bool _shares_draw_state(const geometry_handle* gh, int32_t handle) const; // same buffers and vertex layout, so both fit in one multi draw
+      void _bind_vertex_pulling_buffer(int32_t handle, int32_t channel);
+      void _bind_instance_attributes(const geometry_handle* gh); // in the bound vertex array object
 
       void _compile_shader(int32_t handle, const char* source);
 
       void _remove_buffer_object(geometry_ref& ref);
+      void _resize_buffer_object(buffer_object* buf, int32_t capacity); // new storage with the first min(size, capacity) bytes copied on the gpu
+      virtual int32_t _get_storage_offset_alignment();
+      virtual void _stage_buffer_object_data(int32_t handle, const uint8_t* data, int32_t size, int32_t offset);
+      virtual void _finish_staging();
+      void _gather_copy(uint32_t source_buffer_id, uint32_t destination_buffer_id, size_t first, size_t last); // _copy_regions [first, last) with one dispatch
 
       int32_t _add_texture(int32_t w, int32_t h, int32_t format, const void* data, int32_t flags, int32_t bytes_per_channel);
 
     private:
       std::mutex _semaphore;
+      void* _frame_fences[MAX_FRAMES_IN_FLIGHT]; // GLsync per frame in flight, guards the ring partitions of streaming buffers
       renderpass_descriptor m_current_renderpass_descriptor;
+      uint32_t _vertex_pulling_vertex_array_object_id; // empty, shared by all vertex pulling draws
+      int32_t _indirect_buffer; // streaming buffer object with the commands of the multi draws
+      int32_t _indirect_cursor; // in bytes in the partition of _indirect_frame
+      uint32_t _indirect_frame;
+      std::vector<uint32_t> _indirect_commands; // DrawElementsIndirectCommand: count, instance count, first index, base vertex, base instance
+      uint32_t _staging_buffer_id; // persistently mapped ring of FILE_STAGING_SLOTS chunks, only while a file is uploaded
+      uint8_t* _staging_mapped;
+      void* _staging_fences[FILE_STAGING_SLOTS]; // GLsync per slot, signaled when its copy is done
+      int32_t _staging_slot;
+      uint32_t _gather_program_id;
+      uint32_t _gather_buffer_id;
+      std::vector<std::pair<uint32_t, uint32_t>> _gather_ranges; // destination ranges of a group of regions, sorted
+      std::vector<uint32_t> _gather_regions; // read word, write word, number of words, unused
 
       int32_t _last_assigned_texture_id = -1; // auxiliaury variable for faster finding of a valid texture spot
       int32_t _last_assigned_buffer_object_id = -1; // auxiliaury variable for faster finding of a valid buffer object spot
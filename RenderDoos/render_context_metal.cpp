@@ -7,9 +7,11 @@
 #include "metal/Metal.hpp"
 
 #include "types.h"
+#include "packing.h"
 
 #include <cassert>
 #include <stdexcept>
+#include <algorithm>
 #include <string>
 
 namespace RenderDoos
@@ -42,7 +44,7 @@ namespace RenderDoos
 
   render_context_metal::render_context_metal(MTL::Device* device, MTL::Library* library) : render_context(), mp_device(device), mp_default_library(nullptr),
     mp_command_queue(nullptr), mp_drawable(nullptr), mp_command_buffer(nullptr), mp_render_command_encoder(nullptr), mp_screen(nullptr),
-    mp_depth_stencil_state(nullptr), mp_compute_command_encoder(nullptr), _enable_blending(false), _blending_source(blending_type::one), _blending_destination(blending_type::one),
+    mp_depth_stencil_state(nullptr), mp_compute_command_encoder(nullptr), mp_blit_command_buffer(nullptr), _blit_resumes_compute(false), _indirect_buffer(-1), _indirect_cursor(0), _indirect_frame(0), _enable_blending(false), _blending_source(blending_type::one), _blending_destination(blending_type::one),
     _blending_func(blending_equation_type::add)
     {
     //mp_auto_release_pool = NS::AutoreleasePool::alloc()->init();
@@ -77,24 +79,50 @@ namespace RenderDoos
     //mp_auto_release_pool->release();
     }
 
+  void render_context_metal::destroy()
+    {
+    render_context::destroy();
+    _indirect_buffer = -1; // removed with the other buffer objects
+    for (const auto& upload : _pending_uploads)
+      {
+      upload.staging->release();
+      upload.destination->release();
+      }
+    _pending_uploads.clear();
+    for (int i = 0; i < MAX_READBACKS; ++i) // pending readbacks are dropped, their command buffers keep what they use alive
+      {
+      readback_handle* rb = &_readbacks[i];
+      if (rb->fence)
+        ((MTL::CommandBuffer*)rb->fence)->release();
+      if (rb->metal_buffer)
+        ((MTL::Buffer*)rb->metal_buffer)->release();
+      memset(rb, 0, sizeof(readback_handle));
+      }
+    }
+
   void render_context_metal::frame_begin(render_drawables drawables)
     {
     mp_auto_release_pool = NS::AutoreleasePool::alloc()->init();
     mp_drawable = (MTL::Drawable*)drawables.metal_drawable;
     mp_screen = (MTL::Texture*)drawables.metal_screen_texture;
     dispatch_semaphore_wait(_semaphore, DISPATCH_TIME_FOREVER);
+    _release_deferred_removals();
 
     mp_command_buffer = mp_command_queue->commandBuffer();
-    mp_command_buffer->addCompletedHandler([&](MTL::CommandBuffer* buf) {dispatch_semaphore_signal(_semaphore); });
     }
 
   void render_context_metal::frame_end(bool wait_until_completed)
     {
     if (mp_drawable)
       mp_command_buffer->presentDrawable(mp_drawable);
+    // on the last command buffer of the frame, readbacks may have committed earlier ones
+    mp_command_buffer->addCompletedHandler([&](MTL::CommandBuffer* buf) {dispatch_semaphore_signal(_semaphore); });
     mp_command_buffer->commit();
     if (wait_until_completed)
       mp_command_buffer->waitUntilCompleted();
+    // frame_begin waits on the previous command buffer, so the ring partition of the next frame is never in use by the gpu
+    ++_frame_index;
+    _finish_frame_statistics();
     mp_drawable = nullptr;
     mp_command_buffer = nullptr;
     mp_auto_release_pool->release();
@@ -168,6 +196,7 @@ namespace RenderDoos
       mp_compute_command_encoder->endEncoding();
       mp_compute_command_encoder = nullptr;
       }
+    _flush_pending_uploads(); // the updates made during the pass
     }
 
 
@@ -640,6 +669,8 @@ namespace RenderDoos
     texture* tex = &_textures[handle];
     if (tex->flags == 0)
       return;
+    if (!_shared_resources.empty())
+      _forget_shared(RESOURCE_TEXTURE, handle);
     MTL::Texture* p_tex = (MTL::Texture*)tex->metal_texture;
     p_tex->release();
     tex->metal_texture = 0;
@@ -780,9 +811,13 @@ namespace RenderDoos
     p_command_buffer->commit();  
   }
 
-  int32_t render_context_metal::add_geometry(int32_t vertex_declaration_type)
+  int32_t render_context_metal::add_geometry(int32_t vertex_declaration_type, int32_t index_type, int32_t geometry_flags)
     {
-    if (vertex_declaration_type < VERTEX_STANDARD || vertex_declaration_type > VERTEX_2_2_3)
+    if (vertex_declaration_type < VERTEX_STANDARD || vertex_declaration_type > VERTEX_COLOR_QUANTIZED)
+      return -1;
+    if (index_type != INDEX_TYPE_AUTO && index_type != INDEX_TYPE_16 && index_type != INDEX_TYPE_32)
+      return -1;
+    if ((geometry_flags & GEOMETRY_POOLED) && (geometry_flags & (GEOMETRY_STREAMING | GEOMETRY_ZERO_COPY)))
       return -1;
     geometry_handle* gh = _geometry_handles;
     for (int32_t i = 0; i < MAX_GEOMETRY; ++i)
@@ -805,6 +840,15 @@ namespace RenderDoos
           case VERTEX_2_2_3:
             gh->vertex_size = 28;
             break;
+          case VERTEX_STANDARD_QUANTIZED:
+            gh->vertex_size = 16;
+            break;
+          case VERTEX_COMPACT_QUANTIZED:
+            gh->vertex_size = 12;
+            break;
+          case VERTEX_COLOR_QUANTIZED:
+            gh->vertex_size = 16;
+            break;
           default:
             gh->vertex_size = 32;
             break;
@@ -814,6 +858,10 @@ namespace RenderDoos
         gh->locked = 0;
         gh->vertex.buffer = -1;
         gh->index.buffer = -1;
+        gh->index_type = index_type;
+        gh->index_size = index_type == INDEX_TYPE_16 ? sizeof(uint16_t) : sizeof(uint32_t);
+        gh->flags = geometry_flags;
+        gh->instance_buffer = -1;
         return i;
         }
       ++gh;
@@ -828,7 +876,7 @@ namespace RenderDoos
     buffer_object* buf = &_buffer_objects[ref.buffer];
     if (buf->size > 0)
       {
-      delete[] buf->raw;
+      _free_host_memory(buf);
       MTL::Buffer* p_buf = (MTL::Buffer*)buf->metal_buffer;
       p_buf->release();
       }
@@ -836,6 +884,8 @@ namespace RenderDoos
     buf->raw = nullptr;
     buf->type = 0;
     buf->metal_buffer = 0;
+    buf->flags = 0;
+    buf->mapped = nullptr;
     ref.count = 0;
     }
 
@@ -850,6 +900,15 @@ namespace RenderDoos
     geo->mode = 0;
     //glDeleteVertexArrays(1, &geo->gl_vertex_array_object_id);
     //glCheckError();
+    _remove_submeshes(handle);
+    if (geo->flags & GEOMETRY_POOLED) // the pool buffers stay
+      {
+      _release_pooled(geo->vertex);
+      _release_pooled(geo->index);
+      return;
+      }
+    if (geo->flags & GEOMETRY_EXTERNAL_BUFFERS) // the compute buffers belong to the caller
+      return;
     _remove_geometry_buffer(geo->vertex);
     _remove_geometry_buffer(geo->index);
     }
@@ -924,13 +983,40 @@ namespace RenderDoos
       if (buf->size == 0)
         {
         buf->size = size;
+        buf->capacity = size;
         buf->type = COMPUTE_BUFFER;
+        buf->flags = buffer_type & ~(BUFFER_TYPE_MASK | BUFFER_SUBALLOCATED);
+        buf->offset = 0;
+        buf->arena = -1;
+        if ((buffer_type & BUFFER_SUBALLOCATED) && !(buf->flags & BUFFER_STREAMING) && _suballocate(buf, size))
+          {
+          if (data)
+            {
+            memcpy((uint8_t*)((MTL::Buffer*)buf->metal_buffer)->contents() + buf->offset, data, size);
+            _statistics.bytes_uploaded += size;
+            }
+          _last_assigned_buffer_object_id = i;
+          return i;
+          }
         MTL::ResourceOptions options = MTL::ResourceStorageModeShared;
         MTL::Buffer* p_buffer;
-        if (data == nullptr)
+        if (buf->flags & BUFFER_STREAMING)
+          {
+          _create_streaming_storage(buf);
+          if (data)
+            {
+            memcpy(_streaming_partition(buf), data, size);
+            buf->written = size;
+            buf->written_frame = _frame_index;
+            }
+          p_buffer = (MTL::Buffer*)buf->metal_buffer;
+          }
+        else if (data == nullptr)
           p_buffer = mp_device->newBuffer(size, options);
         else
           p_buffer = mp_device->newBuffer(data, size, options);
+        if (data)
+          _statistics.bytes_uploaded += size;
         buf->metal_buffer = (MTL::Buffer*)p_buffer;
         _last_assigned_buffer_object_id = i;
         return i;
@@ -944,15 +1030,37 @@ namespace RenderDoos
     if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
       return;
     buffer_object* buf = &_buffer_objects[handle];
-    if (buf->size > 0)
+    if (!_shared_resources.empty())
+      _forget_shared(RESOURCE_BUFFER_OBJECT, handle);
+    if (buf->size > 0 && (buf->flags & BUFFER_SUBALLOCATED))
+      _release_suballocated(buf);
+    else if (buf->size > 0)
       {
-      delete[] buf->raw;
+      _free_host_memory(buf);
       MTL::Buffer* p_buf = (MTL::Buffer*)buf->metal_buffer;
       p_buf->release();
       }
     buf->size = 0;
+    buf->capacity = 0;
     buf->raw = nullptr;
     buf->type = 0;
+    buf->metal_buffer = 0;
+    buf->flags = 0;
+    buf->mapped = nullptr;
+    buf->offset = 0;
+    buf->arena = -1;
+    }
+
+  void render_context_metal::_create_streaming_storage(buffer_object* buf)
+    {
+    buf->stride = ((buf->size > 0 ? buf->size : 1) + STREAMING_PARTITION_ALIGNMENT - 1) & ~(STREAMING_PARTITION_ALIGNMENT - 1);
+    buf->partition = 0;
+    buf->written = 0;
+    MTL::Buffer* p_buffer = mp_device->newBuffer(buf->stride * MAX_FRAMES_IN_FLIGHT, MTL::ResourceStorageModeShared);
+    if (!p_buffer)
+      throw std::runtime_error("Could not allocate streaming buffer");
+    buf->metal_buffer = p_buffer;
+    buf->mapped = (uint8_t*)p_buffer->contents();
     }
 
   void render_context_metal::update_buffer_object(int32_t handle, const void* data, int32_t size, int32_t offset)
@@ -960,11 +1068,146 @@ namespace RenderDoos
     if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
       return;
     buffer_object* buf = &_buffer_objects[handle];
-    if (buf->size > 0)
+    if (buf->size > 0 && (buf->flags & BUFFER_STREAMING))
       {
+      _check_streaming_write(buf, offset, size);
+      if (offset + size > buf->size)
+        {
+        ((MTL::Buffer*)buf->metal_buffer)->release();
+        buf->size = offset + size;
+        buf->capacity = buf->size;
+        _create_streaming_storage(buf);
+        }
+      memcpy(_streaming_partition(buf) + offset, data, size);
+      buf->written = offset + size;
+      buf->written_frame = _frame_index;
+      _statistics.bytes_uploaded += size;
+      }
+    else if (buf->size > 0)
+      {
+      bool pending = false;
+      if (offset + size > std::max(buf->capacity, buf->size)) // geometric growth, so that appending is amortized
+        pending = _resize_buffer_object(buf, std::max(offset + size, 2 * std::max(buf->capacity, buf->size)));
+      if (offset + size > buf->size)
+        buf->size = offset + size;
       MTL::Buffer* p_buf = (MTL::Buffer*)buf->metal_buffer;
-      memcpy((void*)((uint8_t*)p_buf->contents()+offset), data, size);
+      if (pending) // the old contents are copied later in the frame, so the new bytes go after them
+        {
+        MTL::Buffer* p_staging = mp_device->newBuffer(data, size, MTL::ResourceStorageModeShared);
+        if (!p_staging)
+          throw std::runtime_error("Could not allocate staging buffer");
+        MTL::BlitCommandEncoder* p_blit = _begin_blit();
+        p_blit->copyFromBuffer(p_staging, 0, p_buf, _partition_offset(buf) + offset, size);
+        _end_blit(p_blit);
+        p_staging->release();
+        }
+      else
+        memcpy((void*)((uint8_t*)p_buf->contents() + _partition_offset(buf) + offset), data, size);
+      _statistics.bytes_uploaded += size;
+      }
+    }
+
+  void render_context_metal::reserve_buffer_object(int32_t handle, int32_t capacity)
+    {
+    if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
+      return;
+    buffer_object* buf = &_buffer_objects[handle];
+    if (buf->size == 0 || (buf->flags & (BUFFER_STREAMING | BUFFER_POOLED)))
+      return;
+    if (capacity > std::max(buf->capacity, buf->size))
+      _resize_buffer_object(buf, capacity);
+    }
+
+  void render_context_metal::shrink_buffer_object(int32_t handle)
+    {
+    if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
+      return;
+    buffer_object* buf = &_buffer_objects[handle];
+    if (buf->size == 0 || (buf->flags & (BUFFER_STREAMING | BUFFER_POOLED)))
+      return;
+    if (buf->capacity > buf->size)
+      _resize_buffer_object(buf, buf->size);
+    }
+
+  bool render_context_metal::_resize_buffer_object(buffer_object* buf, int32_t capacity)
+    {
+    // a suballocated buffer moves to another range, or to storage of its own when it outgrew the arenas
+    const buffer_object old = *buf;
+    if (!(old.flags & BUFFER_SUBALLOCATED) || !_suballocate(buf, capacity))
+      {
+      MTL::Buffer* p_new = mp_device->newBuffer(capacity, MTL::ResourceStorageModeShared);
+      if (!p_new)
+        throw std::runtime_error("Could not allocate buffer");
+      buf->metal_buffer = p_new;
+      buf->flags &= ~BUFFER_SUBALLOCATED;
+      buf->offset = 0;
+      buf->arena = -1;
+      buf->capacity = capacity;
+      }
+    int32_t keep = std::min(buf->size, capacity);
+    bool pending = false;
+    if (keep > 0)
+      {
+      if (mp_render_command_encoder) // no blit inside a render pass, the shared storage is copied on the cpu
+        memcpy((uint8_t*)((MTL::Buffer*)buf->metal_buffer)->contents() + _partition_offset(buf), (const uint8_t*)((MTL::Buffer*)old.metal_buffer)->contents() + _partition_offset(&old), keep);
+      else
+        {
+        // in order with the work encoded so far, so that the gpu writes of this frame to the old storage are kept
+        MTL::BlitCommandEncoder* p_blit = _begin_blit();
+        p_blit->copyFromBuffer((MTL::Buffer*)old.metal_buffer, _partition_offset(&old), (MTL::Buffer*)buf->metal_buffer, _partition_offset(buf), keep);
+        _end_blit(p_blit);
+        pending = mp_command_buffer != nullptr;
+        }
+      }
+    if (old.flags & BUFFER_SUBALLOCATED)
+      _release_suballocated(&old);
+    else
+      ((MTL::Buffer*)old.metal_buffer)->release(); // the command buffer keeps its own reference
+    buf->size = keep;
+    return pending;
+    }
+
+  MTL::BlitCommandEncoder* render_context_metal::_begin_blit()
+    {
+    assert(mp_render_command_encoder == nullptr);
+    _blit_resumes_compute = mp_compute_command_encoder != nullptr;
+    if (_blit_resumes_compute)
+      {
+      mp_compute_command_encoder->endEncoding();
+      mp_compute_command_encoder = nullptr;
+      }
+    mp_blit_command_buffer = mp_command_buffer ? mp_command_buffer : mp_command_queue->commandBuffer();
+    return mp_blit_command_buffer->blitCommandEncoder();
+    }
+
+  void render_context_metal::_end_blit(MTL::BlitCommandEncoder* p_blit)
+    {
+    p_blit->endEncoding();
+    if (mp_blit_command_buffer != mp_command_buffer) // outside a frame nothing else orders the copy before the cpu reads the buffer
+      {
+      mp_blit_command_buffer->commit();
+      mp_blit_command_buffer->waitUntilCompleted();
       }
+    else if (_blit_resumes_compute)
+      mp_compute_command_encoder = mp_command_buffer->computeCommandEncoder();
+    mp_blit_command_buffer = nullptr;
+    }
+
+  void render_context_metal::_stage_buffer_object_data(int32_t handle, const uint8_t* data, int32_t size, int32_t offset)
+    {
+    // shared storage is visible to the gpu, so the chunk goes straight from the mapped file into the buffer
+    buffer_object* buf = &_buffer_objects[handle];
+    memcpy((uint8_t*)((MTL::Buffer*)buf->metal_buffer)->contents() + _partition_offset(buf) + offset, data, size);
+    _statistics.bytes_uploaded += size;
+    }
+
+  void render_context_metal::_finish_staging()
+    {
+    }
+
+  int32_t render_context_metal::_get_storage_offset_alignment()
+    {
+    return 256; // buffer offsets of the constant address space on macOS
     }
 
   void render_context_metal::bind_buffer_object(int32_t handle, int32_t channel, int32_t target)
@@ -975,6 +1218,7 @@ namespace RenderDoos
     if (buf->size > 0)
       {
       MTL::Buffer* p_buf = (MTL::Buffer*)buf->metal_buffer;
+      int32_t offset = _partition_offset(buf);
       if (mp_render_command_encoder)
         {
         if (target == BIND_TO_DEFAULT)
@@ -982,13 +1226,13 @@ namespace RenderDoos
           switch (buf->type)
             {
             case GEOMETRY_VERTEX:
-              mp_render_command_encoder->setVertexBuffer(p_buf, 0, channel);
+              mp_render_command_encoder->setVertexBuffer(p_buf, offset, channel);
               break;
             case GEOMETRY_INDEX:
-              mp_render_command_encoder->setFragmentBuffer(p_buf, 0, channel);
+              mp_render_command_encoder->setFragmentBuffer(p_buf, offset, channel);
               break;
             case COMPUTE_BUFFER:
-              mp_render_command_encoder->setFragmentBuffer(p_buf, 0, channel);
+              mp_render_command_encoder->setFragmentBuffer(p_buf, offset, channel);
               break;
             default:
               break;
@@ -999,10 +1243,10 @@ namespace RenderDoos
           switch (target)
             {
             case BIND_TO_VERTEX_SHADER:
-              mp_render_command_encoder->setVertexBuffer(p_buf, 0, channel);
+              mp_render_command_encoder->setVertexBuffer(p_buf, offset, channel);
               break;
             case BIND_TO_FRAGMENT_SHADER:
-              mp_render_command_encoder->setFragmentBuffer(p_buf, 0, channel);
+              mp_render_command_encoder->setFragmentBuffer(p_buf, offset, channel);
               break;              
             }
           }
@@ -1012,7 +1256,7 @@ namespace RenderDoos
         switch (buf->type)
           {
           case COMPUTE_BUFFER:
-            mp_compute_command_encoder->setBuffer(p_buf, 0, channel);
+            mp_compute_command_encoder->setBuffer(p_buf, offset, channel);
             break;
           default:
             break;
@@ -1029,10 +1273,79 @@ namespace RenderDoos
     if (buf->size > 0)
       {
       MTL::Buffer* p_buf = (MTL::Buffer*)buf->metal_buffer;
-      memcpy(data, p_buf->contents(), size);
+      memcpy(data, (uint8_t*)p_buf->contents() + _partition_offset(buf), size);
       }
     }
 
+  int32_t render_context_metal::readback_buffer_object(int32_t handle, int32_t size, int32_t offset)
+    {
+    if (handle < 0 || handle >= MAX_BUFFER_OBJECT || size <= 0 || mp_render_command_encoder)
+      return -1;
+    buffer_object* buf = &_buffer_objects[handle];
+    if (buf->size == 0)
+      return -1;
+    for (int32_t i = 0; i < MAX_READBACKS; ++i)
+      {
+      readback_handle* rb = &_readbacks[i];
+      if (rb->size > 0)
+        continue;
+      if (rb->capacity < size)
+        {
+        if (rb->metal_buffer)
+          ((MTL::Buffer*)rb->metal_buffer)->release();
+        MTL::Buffer* p_buffer = mp_device->newBuffer(size, MTL::ResourceStorageModeShared);
+        if (!p_buffer)
+          throw std::runtime_error("Could not allocate readback buffer");
+        rb->metal_buffer = p_buffer;
+        rb->mapped = (uint8_t*)p_buffer->contents();
+        rb->capacity = size;
+        }
+      // the copy is committed with the work sent so far, a compute pass continues in a new encoder
+      bool compute = mp_compute_command_encoder != nullptr;
+      if (compute)
+        {
+        mp_compute_command_encoder->endEncoding();
+        mp_compute_command_encoder = nullptr;
+        }
+      MTL::CommandBuffer* p_command_buffer = mp_command_buffer ? mp_command_buffer : mp_command_queue->commandBuffer();
+      MTL::BlitCommandEncoder* p_blit = p_command_buffer->blitCommandEncoder();
+      p_blit->copyFromBuffer((MTL::Buffer*)buf->metal_buffer, _partition_offset(buf) + offset, (MTL::Buffer*)rb->metal_buffer, 0, size);
+      p_blit->endEncoding();
+      p_command_buffer->retain();
+      p_command_buffer->commit();
+      if (mp_command_buffer)
+        {
+        mp_command_buffer = mp_command_queue->commandBuffer();
+        if (compute)
+          mp_compute_command_encoder = mp_command_buffer->computeCommandEncoder();
+        }
+      rb->fence = p_command_buffer;
+      rb->size = size;
+      return i;
+      }
+    return -1;
+    }
+
+  bool render_context_metal::is_readback_ready(int32_t readback)
+    {
+    if (readback < 0 || readback >= MAX_READBACKS || _readbacks[readback].size == 0)
+      return false;
+    return ((MTL::CommandBuffer*)_readbacks[readback].fence)->status() == MTL::CommandBufferStatusCompleted;
+    }
+
+  void render_context_metal::finish_readback(int32_t readback, void* data)
+    {
+    if (readback < 0 || readback >= MAX_READBACKS || _readbacks[readback].size == 0)
+      return;
+    readback_handle* rb = &_readbacks[readback];
+    MTL::CommandBuffer* p_command_buffer = (MTL::CommandBuffer*)rb->fence;
+    p_command_buffer->waitUntilCompleted();
+    p_command_buffer->release();
+    memcpy(data, rb->mapped, rb->size);
+    rb->fence = nullptr;
+    rb->size = 0;
+    }
+
   const buffer_object* render_context_metal::get_buffer_object(int32_t handle) const
     {
     if (handle < 0 || handle >= MAX_BUFFER_OBJECT)
@@ -1053,7 +1366,25 @@ namespace RenderDoos
     MTL::CommandBuffer* p_command_buffer = mp_command_queue->commandBuffer();
     //p_command_buffer->addCompletedHandler([&](MTL::CommandBuffer* buf){dispatch_semaphore_signal(_semaphore);});
     MTL::BlitCommandEncoder* p_blit = p_command_buffer->blitCommandEncoder();
-    p_blit->copyFromBuffer(p_buf_src, read_offset, p_buf_dst, write_offset, size);
+    p_blit->copyFromBuffer(p_buf_src, read_offset + _partition_offset(src), p_buf_dst, write_offset + _partition_offset(dst), size);
+    p_blit->endEncoding();
+    p_command_buffer->commit();
+    }
+
+  void render_context_metal::copy_buffer_object_regions(const buffer_copy_region* regions, int32_t number_of_regions)
+    {
+    _merge_copy_regions(regions, number_of_regions);
+    if (_copy_regions.empty())
+      return;
+    // all copies go in one blit encoder, so the number of copies is what is left after merging
+    MTL::CommandBuffer* p_command_buffer = mp_command_queue->commandBuffer();
+    MTL::BlitCommandEncoder* p_blit = p_command_buffer->blitCommandEncoder();
+    for (const auto& region : _copy_regions)
+      {
+      MTL::Buffer* p_buf_src = (MTL::Buffer*)_buffer_objects[region.source].metal_buffer;
+      MTL::Buffer* p_buf_dst = (MTL::Buffer*)_buffer_objects[region.destination].metal_buffer;
+      p_blit->copyFromBuffer(p_buf_src, region.read_offset, p_buf_dst, region.write_offset, region.size);
+      }
     p_blit->endEncoding();
     p_command_buffer->commit();
     }
@@ -1088,19 +1419,120 @@ namespace RenderDoos
         buf->metal_buffer = 0;
         p_buf->release();
         }
-      if (buf->raw)
+      _allocate_host_memory(buf, size);
+      buf->size = size;
+      buf->type = type;
+      ref.number_of_dirty_ranges = -1; // new storage, everything has to be sent
+      }
+    else
+      ref.number_of_dirty_ranges = 0;
+    ref.count = count;
+    if (pointer)
+      {
+      *pointer = (void*)buf->raw;
+      }
+    }
+
+  void render_context_metal::_allocate_streaming_geometry_buffer(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer)
+    {
+    assert(type == GEOMETRY_VERTEX || type == GEOMETRY_INDEX);
+    if (ref.buffer < 0) // no actual buffer assigned yet
+      {
+      buffer_object* buf = _buffer_objects;
+      for (int32_t i = 0; i < MAX_BUFFER_OBJECT; ++i)
         {
-        delete[] buf->raw;
+        if (buf->size == 0)
+          {
+          ref.buffer = i;
+          buf->type = 0;
+          break;
+          }
+        ++buf;
         }
-      buf->raw = new uint8_t[size];
+      if (ref.buffer < 0) // all buffers are used
+        throw std::runtime_error("Out of memory");
+      }
+    buffer_object* buf = &_buffer_objects[ref.buffer];
+    int32_t size = tuple_size * count;
+    if (buf->size < size || (buf->type != type))
+      {
+      if (buf->metal_buffer)
+        ((MTL::Buffer*)buf->metal_buffer)->release();
       buf->size = size;
       buf->type = type;
-      ref.count = count;
+      buf->flags = BUFFER_STREAMING;
+      _create_streaming_storage(buf);
       }
+    ref.count = count;
+    ref.number_of_dirty_ranges = 0;
+    uint8_t* partition = _streaming_partition(buf);
     if (pointer)
       {
-      *pointer = (void*)buf->raw;
+      *pointer = (void*)partition;
+      }
+    }
+
+  void render_context_metal::_allocate_mapped_geometry_buffer(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer)
+    {
+    assert(type == GEOMETRY_VERTEX || type == GEOMETRY_INDEX);
+    if (ref.buffer < 0) // no actual buffer assigned yet
+      {
+      buffer_object* buf = _buffer_objects;
+      for (int32_t i = 0; i < MAX_BUFFER_OBJECT; ++i)
+        {
+        if (buf->size == 0)
+          {
+          ref.buffer = i;
+          buf->type = 0;
+          break;
+          }
+        ++buf;
+        }
+      if (ref.buffer < 0) // all buffers are used
+        throw std::runtime_error("Out of memory");
+      }
+    buffer_object* buf = &_buffer_objects[ref.buffer];
+    int32_t size = tuple_size * count;
+    if (buf->size < size || (buf->type != type) || !buf->metal_buffer)
+      {
+      if (buf->metal_buffer) // in flight command buffers keep their own reference
+        ((MTL::Buffer*)buf->metal_buffer)->release();
+      buf->metal_buffer = mp_device->newBuffer(size > 0 ? size : 1, MTL::ResourceStorageModeShared);
+      buf->size = size;
+      buf->type = type;
+      ref.number_of_dirty_ranges = -1; // new storage, everything has to be written
+      }
+    else
+      ref.number_of_dirty_ranges = 0;
+    ref.count = count;
+    buf->mapped = (uint8_t*)((MTL::Buffer*)buf->metal_buffer)->contents();
+    if (pointer)
+      {
+      *pointer = (void*)buf->mapped;
+      }
+    }
+
+  void render_context_metal::_unmap_geometry_buffer(geometry_ref& ref, int32_t size)
+    {
+    if (ref.buffer < 0)
+      return;
+    buffer_object* buf = &_buffer_objects[ref.buffer];
+    if (ref.number_of_dirty_ranges > 0) // shared storage needs no flush, only count what was written
+      {
+      for (int32_t i = 0; i < ref.number_of_dirty_ranges; ++i)
+        {
+        int32_t offset = ref.dirty_ranges[i].offset < 0 ? 0 : ref.dirty_ranges[i].offset;
+        int32_t end = ref.dirty_ranges[i].offset + ref.dirty_ranges[i].size;
+        if (end > size)
+          end = size;
+        if (end > offset)
+          _statistics.bytes_uploaded += end - offset;
+        }
       }
+    else
+      _statistics.bytes_uploaded += size;
+    ref.number_of_dirty_ranges = 0;
+    buf->mapped = nullptr;
     }
 
   void render_context_metal::geometry_begin(int32_t handle, int32_t number_of_vertices, int32_t number_of_indices, float** vertex_pointer, void** index_pointer, int32_t update)
@@ -1108,7 +1540,7 @@ namespace RenderDoos
     if (handle < 0 || handle >= MAX_GEOMETRY)
       return;
     geometry_handle* gh = &_geometry_handles[handle];
-    if (gh->mode == 0)
+    if (gh->mode == 0 || (gh->flags & GEOMETRY_EXTERNAL_BUFFERS))
       return;
     if (vertex_pointer)
       *vertex_pointer = 0;
@@ -1118,23 +1550,180 @@ namespace RenderDoos
     if ((update & GEOMETRY_VERTEX) && !(gh->locked & GEOMETRY_VERTEX)) // vertices
       {
       gh->locked |= GEOMETRY_VERTEX;
-      _allocate_geometry_buffer(gh->vertex, gh->vertex_size, number_of_vertices, GEOMETRY_VERTEX, (void**)vertex_pointer);
+      if (gh->flags & GEOMETRY_STREAMING)
+        _allocate_streaming_geometry_buffer(gh->vertex, gh->vertex_size, number_of_vertices, GEOMETRY_VERTEX, (void**)vertex_pointer);
+      else if (gh->flags & GEOMETRY_ZERO_COPY)
+        _allocate_mapped_geometry_buffer(gh->vertex, gh->vertex_size, number_of_vertices, GEOMETRY_VERTEX, (void**)vertex_pointer);
+      else if (gh->flags & GEOMETRY_POOLED)
+        {
+        uint8_t* pointer = _allocate_pooled(gh->vertex, _get_geometry_pool(gh, GEOMETRY_VERTEX), number_of_vertices, GEOMETRY_VERTEX);
+        if (vertex_pointer)
+          *vertex_pointer = (float*)pointer;
+        }
+      else
+        _allocate_geometry_buffer(gh->vertex, gh->vertex_size, number_of_vertices, GEOMETRY_VERTEX, (void**)vertex_pointer);
       }
     if ((update & GEOMETRY_INDEX) && !(gh->locked & GEOMETRY_INDEX)) // indices
       {
       gh->locked |= GEOMETRY_INDEX;
-      _allocate_geometry_buffer(gh->index, sizeof(uint32_t), number_of_indices, GEOMETRY_INDEX, (void**)index_pointer);
+      int32_t previous_index_size = gh->index_size;
+      gh->index_size = _get_index_size(gh, (update & GEOMETRY_VERTEX) ? number_of_vertices : gh->vertex.count);
+      int32_t user_index_size = gh->index_type == INDEX_TYPE_AUTO ? sizeof(uint32_t) : gh->index_size;
+      if (gh->flags & (GEOMETRY_STREAMING | GEOMETRY_ZERO_COPY))
+        {
+        bool staging = user_index_size != gh->index_size; // the user writes 32-bit indices to a staging block that geometry_end narrows into gpu memory
+        if (gh->flags & GEOMETRY_STREAMING)
+          _allocate_streaming_geometry_buffer(gh->index, gh->index_size, number_of_indices, GEOMETRY_INDEX, staging ? nullptr : (void**)index_pointer);
+        else
+          _allocate_mapped_geometry_buffer(gh->index, gh->index_size, number_of_indices, GEOMETRY_INDEX, staging ? nullptr : (void**)index_pointer);
+        if (staging)
+          {
+          buffer_object* buf = &_buffer_objects[gh->index.buffer];
+          _allocate_host_memory(buf, number_of_indices * user_index_size);
+          if (index_pointer)
+            *index_pointer = (void*)buf->raw;
+          }
+        }
+      else if (gh->flags & GEOMETRY_POOLED)
+        {
+        uint8_t* pointer = _allocate_pooled(gh->index, _get_geometry_pool(gh, GEOMETRY_INDEX), number_of_indices, GEOMETRY_INDEX);
+        if (user_index_size != gh->index_size) // the pool holds 16-bit indices, so the user writes to a staging block
+          {
+          gh->index_staging = new uint8_t[number_of_indices * user_index_size];
+          _statistics.host_memory += number_of_indices * user_index_size;
+          pointer = gh->index_staging;
+          }
+        if (index_pointer)
+          *index_pointer = (void*)pointer;
+        }
+      else
+        _allocate_geometry_buffer(gh->index, user_index_size, number_of_indices, GEOMETRY_INDEX, (void**)index_pointer);
+      if (gh->index_size != previous_index_size)
+        gh->index.number_of_dirty_ranges = -1;
       }
     }
 
-  void render_context_metal::_update_geometry_buffer(geometry_ref& ref)
+  void render_context_metal::_update_geometry_buffer(geometry_ref& ref, int32_t element_size)
     {
     if (ref.buffer < 0)
       return;
     buffer_object* buf = &_buffer_objects[ref.buffer];
-    MTL::ResourceOptions options = 0;
-    MTL::Buffer* p_buffer = mp_device->newBuffer((const void*)buf->raw, buf->size, options);
-    buf->metal_buffer = p_buffer;
+    int32_t size = ref.count * element_size;
+    int32_t base = ref.offset * element_size; // start of the range of a pooled geometry
+    bool pooled = (buf->flags & BUFFER_POOLED) != 0; // other geometries live in the same buffer, so it cannot be replaced
+    if (buf->metal_buffer && (pooled || (ref.number_of_dirty_ranges > 0 && !mp_render_command_encoder)))
+      {
+      // in flight frames and the draws encoded so far read the buffer, so the bytes are blitted in order with the frame.
+      // Inside a render pass the buffer of a geometry of its own is replaced below instead.
+      dirty_range ranges[MAX_DIRTY_RANGES];
+      int32_t number_of_ranges = 0;
+      if (ref.number_of_dirty_ranges > 0) // only the changed bytes
+        {
+        for (int32_t i = 0; i < ref.number_of_dirty_ranges; ++i)
+          {
+          int32_t offset = ref.dirty_ranges[i].offset < 0 ? 0 : ref.dirty_ranges[i].offset;
+          int32_t end = ref.dirty_ranges[i].offset + ref.dirty_ranges[i].size;
+          if (end > size)
+            end = size;
+          if (end <= offset)
+            continue;
+          ranges[number_of_ranges].offset = base + offset;
+          ranges[number_of_ranges].size = end - offset;
+          ++number_of_ranges;
+          }
+        }
+      else if (size > 0)
+        {
+        ranges[0].offset = base;
+        ranges[0].size = size;
+        number_of_ranges = 1;
+        }
+      _upload_ranges((MTL::Buffer*)buf->metal_buffer, buf->raw, ranges, number_of_ranges);
+      }
+    else
+      {
+      if (buf->metal_buffer) // in flight command buffers keep their own reference
+        ((MTL::Buffer*)buf->metal_buffer)->release();
+      MTL::ResourceOptions options = 0;
+      MTL::Buffer* p_buffer = mp_device->newBuffer((const void*)buf->raw, size > 0 ? size : buf->size, options);
+      buf->metal_buffer = p_buffer;
+      _statistics.bytes_uploaded += size;
+      }
+    ref.number_of_dirty_ranges = 0;
+    }
+
+  void render_context_metal::_update_geometry_pool(buffer_object* buf, int32_t size)
+    {
+    if (buf->size != buf->raw_size) // first initialization or the pool grew
+      {
+      if (buf->metal_buffer) // in flight command buffers keep their own reference
+        ((MTL::Buffer*)buf->metal_buffer)->release();
+      buf->metal_buffer = mp_device->newBuffer(buf->raw_size, MTL::ResourceStorageModeShared);
+      buf->size = buf->raw_size;
+      if (size > 0) // no draw uses the new storage yet
+        {
+        memcpy(((MTL::Buffer*)buf->metal_buffer)->contents(), buf->raw, size);
+        _statistics.bytes_uploaded += size;
+        }
+      }
+    else if (size > 0) // the ranges moved, while the gpu may still draw from their old places
+      {
+      dirty_range range;
+      range.offset = 0;
+      range.size = size;
+      _upload_ranges((MTL::Buffer*)buf->metal_buffer, buf->raw, &range, 1);
+      }
+    }
+
+  void render_context_metal::_upload_ranges(MTL::Buffer* destination, const uint8_t* source, const dirty_range* ranges, int32_t number_of_ranges)
+    {
+    int32_t staging_size = 0;
+    for (int32_t i = 0; i < number_of_ranges; ++i)
+      staging_size += ranges[i].size;
+    if (staging_size == 0)
+      return;
+    MTL::Buffer* p_staging = mp_device->newBuffer(staging_size, MTL::ResourceStorageModeShared);
+    if (!p_staging)
+      throw std::runtime_error("Could not allocate staging buffer");
+    uint8_t* staging = (uint8_t*)p_staging->contents();
+    MTL::BlitCommandEncoder* p_blit = mp_render_command_encoder ? nullptr : _begin_blit();
+    int32_t staging_offset = 0;
+    for (int32_t i = 0; i < number_of_ranges; ++i)
+      {
+      memcpy(staging + staging_offset, source + ranges[i].offset, ranges[i].size);
+      if (p_blit)
+        p_blit->copyFromBuffer(p_staging, staging_offset, destination, ranges[i].offset, ranges[i].size);
+      else // no blit inside a render pass, the draws of this pass see the old bytes
+        {
+        pending_upload upload;
+        upload.staging = p_staging->retain();
+        upload.destination = destination->retain();
+        upload.staging_offset = staging_offset;
+        upload.destination_offset = ranges[i].offset;
+        upload.size = ranges[i].size;
+        _pending_uploads.push_back(upload);
+        }
+      staging_offset += ranges[i].size;
+      }
+    if (p_blit)
+      _end_blit(p_blit);
+    p_staging->release(); // the command buffer or the pending uploads keep their own reference
+    _statistics.bytes_uploaded += staging_size;
+    }
+
+  void render_context_metal::_flush_pending_uploads()
+    {
+    if (_pending_uploads.empty())
+      return;
+    MTL::BlitCommandEncoder* p_blit = _begin_blit();
+    for (const auto& upload : _pending_uploads)
+      {
+      p_blit->copyFromBuffer(upload.staging, upload.staging_offset, upload.destination, upload.destination_offset, upload.size);
+      upload.staging->release();
+      upload.destination->release();
+      }
+    _end_blit(p_blit);
+    _pending_uploads.clear();
     }
 
   void render_context_metal::geometry_end(int32_t handle)
@@ -1144,19 +1733,73 @@ namespace RenderDoos
     geometry_handle* gh = &_geometry_handles[handle];
     if (gh->mode == 0)
       return;
+    if (gh->flags & GEOMETRY_STREAMING) // the data is already in the ring
+      {
+      if ((gh->locked & GEOMETRY_INDEX) && gh->index.buffer >= 0 && _buffer_objects[gh->index.buffer].raw)
+        {
+        buffer_object* buf = &_buffer_objects[gh->index.buffer];
+        _narrow_indices(gh, buf->mapped + _partition_offset(buf));
+        _free_host_memory(buf);
+        }
+      if (gh->locked & GEOMETRY_VERTEX)
+        _statistics.bytes_uploaded += gh->vertex.count * gh->vertex_size;
+      if (gh->locked & GEOMETRY_INDEX)
+        _statistics.bytes_uploaded += gh->index.count * gh->index_size;
+      gh->locked &= ~(GEOMETRY_VERTEX | GEOMETRY_INDEX);
+      return;
+      }
+    if (gh->flags & GEOMETRY_ZERO_COPY)
+      {
+      if (gh->locked & GEOMETRY_VERTEX)
+        _unmap_geometry_buffer(gh->vertex, gh->vertex.count * gh->vertex_size);
+      if ((gh->locked & GEOMETRY_INDEX) && gh->index.buffer >= 0)
+        {
+        buffer_object* buf = &_buffer_objects[gh->index.buffer];
+        if (buf->raw)
+          {
+          _narrow_indices(gh, buf->mapped);
+          _free_host_memory(buf);
+          }
+        _unmap_geometry_buffer(gh->index, gh->index.count * gh->index_size);
+        }
+      gh->locked &= ~(GEOMETRY_VERTEX | GEOMETRY_INDEX);
+      return;
+      }
     if (gh->locked & GEOMETRY_VERTEX)
       {
-      _update_geometry_buffer(gh->vertex);
+      _update_geometry_buffer(gh->vertex, gh->vertex_size);
       gh->locked &= ~GEOMETRY_VERTEX;
       }
     if (gh->locked & GEOMETRY_INDEX)
       {
-      _update_geometry_buffer(gh->index);
+      _narrow_indices(gh);
+      _update_geometry_buffer(gh->index, gh->index_size);
       gh->locked &= ~GEOMETRY_INDEX;
       }
     }
 
   void render_context_metal::geometry_draw(int32_t handle, int32_t instance_count)
+    {
+    if (handle < 0 || handle >= MAX_GEOMETRY)
+      return;
+    _geometry_draw(handle, 0, _geometry_handles[handle].index.count, 0, instance_count);
+    }
+
+  void render_context_metal::geometry_draw_batch(const draw_command* commands, int32_t number_of_commands)
+    {
+    for (int32_t i = 0; i < number_of_commands; ++i) // metal has no per draw validation overhead to save, so draw one by one
+      {
+      const draw_command& command = commands[i];
+      if (command.geometry < 0 || command.geometry >= MAX_GEOMETRY)
+        continue;
+      int32_t first_index = command.first_index;
+      int32_t index_count = command.index_count;
+      if (_clip_index_range(&_geometry_handles[command.geometry], first_index, index_count))
+        _geometry_draw(command.geometry, first_index, index_count, command.base_vertex, command.instance_count, command.base_instance);
+      }
+    }
+
+  void render_context_metal::_geometry_draw(int32_t handle, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance)
     {
     if (!mp_render_command_encoder)
       return;
@@ -1165,24 +1808,112 @@ namespace RenderDoos
     geometry_handle* gh = &_geometry_handles[handle];
     if (gh->mode == 0)
       return;
+    _draw_geometry(gh, first_index, index_count, base_vertex, instance_count, base_instance);
+    }
+
+  void render_context_metal::transient_geometry_draw(const transient_geometry& tg, int32_t instance_count)
+    {
+    if (!mp_render_command_encoder)
+      return;
+    const geometry_handle* gh = _get_transient_handle(tg);
+    if (gh)
+      _draw_geometry(gh, 0, tg.number_of_indices, 0, instance_count, 0);
+    }
+
+  void render_context_metal::_draw_geometry(const geometry_handle* gh, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance)
+    {
+    _bind_geometry(gh);
+    if (gh->index.buffer >= 0 && gh->index.buffer < MAX_BUFFER_OBJECT)
+      {
+      buffer_object* buf = &_buffer_objects[gh->index.buffer];
+      MTL::Buffer* p_buffer = (MTL::Buffer*)buf->metal_buffer;
+      MTL::IndexType index_type = gh->index_size == sizeof(uint16_t) ? MTL::IndexTypeUInt16 : MTL::IndexTypeUInt32;
+      int32_t offset = _partition_offset(buf) + (gh->index.offset + first_index) * gh->index_size;
+      if (offset % 4) // odd 16-bit first index, e.g. of a submesh: the index buffer offset has to be 4-byte aligned, the start index of an indirect draw not
+        {
+        draw_indirect_command command;
+        command.index_count = (uint32_t)index_count;
+        command.instance_count = (uint32_t)instance_count;
+        command.first_index = 1;
+        command.base_vertex = gh->vertex.offset + base_vertex;
+        command.base_instance = (uint32_t)base_instance;
+        // the arguments of a frame are appended to a ring in shared memory
+        int32_t size = (int32_t)sizeof(draw_indirect_command);
+        if (_indirect_frame != _frame_index)
+          {
+          _indirect_frame = _frame_index;
+          _indirect_cursor = 0;
+          }
+        if (_indirect_buffer < 0 || _indirect_cursor + size > _buffer_objects[_indirect_buffer].size)
+          {
+          int32_t capacity = _indirect_buffer < 0 ? 0 : _buffer_objects[_indirect_buffer].size;
+          if (_indirect_buffer >= 0) // earlier draws of this frame keep the old ring alive until the gpu is done
+            remove_deferred(RESOURCE_BUFFER_OBJECT, _indirect_buffer);
+          capacity = std::max(std::max(2 * capacity, _indirect_cursor + size), 4096);
+          _indirect_buffer = add_buffer_object(nullptr, capacity, COMPUTE_BUFFER | BUFFER_STREAMING);
+          _indirect_cursor = 0;
+          if (_indirect_buffer < 0)
+            throw std::runtime_error("Out of buffer objects for the draw arguments");
+          }
+        update_buffer_object(_indirect_buffer, &command, size, _indirect_cursor);
+        const buffer_object* arguments = &_buffer_objects[_indirect_buffer];
+        mp_render_command_encoder->drawIndexedPrimitives(MTL::PrimitiveTypeTriangle, index_type, p_buffer, offset & ~3, (MTL::Buffer*)arguments->metal_buffer, _partition_offset(arguments) + _indirect_cursor);
+        _indirect_cursor += size;
+        }
+      else
+        mp_render_command_encoder->drawIndexedPrimitives(MTL::PrimitiveTypeTriangle, index_count, index_type, p_buffer, offset, instance_count, gh->vertex.offset + base_vertex, base_instance);
+      ++_statistics.draw_calls;
+      }
+    }
+
+  void render_context_metal::geometry_draw_indirect(int32_t geometry, int32_t command_buffer, int32_t /*count_buffer*/, int32_t max_commands)
+    {
+    if (!mp_render_command_encoder)
+      return;
+    if (geometry < 0 || geometry >= MAX_GEOMETRY || command_buffer < 0 || command_buffer >= MAX_BUFFER_OBJECT)
+      return;
+    geometry_handle* gh = &_geometry_handles[geometry];
+    buffer_object* commands = &_buffer_objects[command_buffer];
+    if (gh->mode == 0 || gh->index.buffer < 0 || commands->size == 0)
+      return;
+    if (max_commands * (int32_t)sizeof(draw_indirect_command) > commands->size)
+      max_commands = commands->size / (int32_t)sizeof(draw_indirect_command);
+    _bind_geometry(gh);
+    buffer_object* buf = &_buffer_objects[gh->index.buffer];
+    MTL::IndexType index_type = gh->index_size == sizeof(uint16_t) ? MTL::IndexTypeUInt16 : MTL::IndexTypeUInt32;
+    // metal has no draw count from a buffer, the commands past the count have an instance count of 0 (see gpu_culling)
+    for (int32_t i = 0; i < max_commands; ++i)
+      mp_render_command_encoder->drawIndexedPrimitives(MTL::PrimitiveTypeTriangle, index_type, (MTL::Buffer*)buf->metal_buffer, _partition_offset(buf), (MTL::Buffer*)commands->metal_buffer, _partition_offset(commands) + i * sizeof(draw_indirect_command));
+    _statistics.draw_calls += max_commands;
+    }
 
+  void render_context_metal::_bind_geometry(const geometry_handle* gh)
+    {
     while (_raw_uniforms.size() % 16)
       _raw_uniforms.push_back(0);
 
     mp_render_command_encoder->setVertexBytes(_raw_uniforms.data(), _raw_uniforms.size(), 10);
     mp_render_command_encoder->setFragmentBytes(_raw_uniforms.data(), _raw_uniforms.size(), 10);
 
+    if (gh->vertex_declaration_type >= VERTEX_STANDARD_QUANTIZED)
+      {
+      float quantization[8] = { gh->quantization_offset[0], gh->quantization_offset[1], gh->quantization_offset[2], 0.f,
+                                gh->quantization_extent[0], gh->quantization_extent[1], gh->quantization_extent[2], 0.f };
+      mp_render_command_encoder->setVertexBytes(quantization, sizeof(quantization), 11); // channel 11 is reserved for the quantization constants
+      }
+
     if (gh->vertex.buffer >= 0 && gh->vertex.buffer < MAX_BUFFER_OBJECT)
       {
       buffer_object* buf = &_buffer_objects[gh->vertex.buffer];
       MTL::Buffer* p_buffer = (MTL::Buffer*)buf->metal_buffer;
-      mp_render_command_encoder->setVertexBuffer(p_buffer, 0, 0);
+      mp_render_command_encoder->setVertexBuffer(p_buffer, _partition_offset(buf), 0);
       }
-    if (gh->index.buffer >= 0 && gh->index.buffer < MAX_BUFFER_OBJECT)
+    if (gh->instance_buffer >= 0 && _buffer_objects[gh->instance_buffer].size > 0)
       {
-      buffer_object* buf = &_buffer_objects[gh->index.buffer];
-      MTL::Buffer* p_buffer = (MTL::Buffer*)buf->metal_buffer;
-      mp_render_command_encoder->drawIndexedPrimitives(MTL::PrimitiveTypeTriangle, gh->index.count, MTL::IndexTypeUInt32, p_buffer, 0, instance_count, 0, 0);
+      buffer_object* buf = &_buffer_objects[gh->instance_buffer];
+      uint32_t stride = (uint32_t)_get_instance_size(gh->instance_layout);
+      mp_render_command_encoder->setVertexBuffer((MTL::Buffer*)buf->metal_buffer, _partition_offset(buf), 1); // channel 1 holds the per instance data
+      mp_render_command_encoder->setVertexBytes(&stride, sizeof(stride), 12);
       }
     }
 
@@ -1521,6 +2252,7 @@ namespace RenderDoos
     int32_t vs = sh->vertex_shader_handle;
     int32_t fs = sh->fragment_shader_handle;
     int32_t cs = sh->compute_shader_handle;
+    _raw_uniforms.clear(); // the uniforms of the previous program are not for this one
     int32_t color_pixel_format = texture_format_bgra8;
     int32_t depth_pixel_format = texture_format_none;
     if (m_current_renderpass_descriptor.frame_buffer_handle >= 0)
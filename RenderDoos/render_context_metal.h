@@ -19,6 +19,7 @@ namespace RenderDoos
       render_context_metal(MTL::Device* device, MTL::Library* library);
       ~render_context_metal();
       
+      virtual void destroy();
       virtual void frame_begin(render_drawables drawables);
       virtual void frame_end(bool wait_until_completed);
       
@@ -44,7 +45,7 @@ namespace RenderDoos
       virtual void get_data_from_texture(int32_t handle, void* data, int32_t size);
       virtual void copy_texture_data(int32_t source_handle, int32_t destination_handle);
 
-      virtual int32_t add_geometry(int32_t vertex_declaration_type); // VERTEX_STANDARD or VERTEX_COMPACT
+      virtual int32_t add_geometry(int32_t vertex_declaration_type, int32_t index_type = INDEX_TYPE_32, int32_t geometry_flags = 0); // VERTEX_STANDARD or VERTEX_COMPACT
       virtual void remove_geometry(int32_t handle);
 
       virtual int32_t add_render_buffer();
@@ -55,8 +56,14 @@ namespace RenderDoos
       virtual void update_buffer_object(int32_t handle, const void* data, int32_t size, int32_t offset);
       virtual void bind_buffer_object(int32_t handle, int32_t channel, int32_t target);
       virtual void get_data_from_buffer_object(int32_t handle, void* data, int32_t size);
+      virtual int32_t readback_buffer_object(int32_t handle, int32_t size, int32_t offset = 0);
+      virtual bool is_readback_ready(int32_t readback);
+      virtual void finish_readback(int32_t readback, void* data);
       virtual const buffer_object* get_buffer_object(int32_t handle) const;
       virtual void copy_buffer_object_data(int32_t source_handle, int32_t destination_handle, uint32_t read_offset, uint32_t write_offset, uint32_t size);
+      virtual void reserve_buffer_object(int32_t handle, int32_t capacity);
+      virtual void shrink_buffer_object(int32_t handle);
+      virtual void copy_buffer_object_regions(const buffer_copy_region* regions, int32_t number_of_regions);
       
       virtual int32_t add_frame_buffer(int32_t w, int32_t h, bool make_depth_texture, int32_t usage_flags);
       virtual void remove_frame_buffer(int32_t handle);
@@ -65,6 +72,9 @@ namespace RenderDoos
       virtual void geometry_begin(int32_t handle, int32_t number_of_vertices, int32_t number_of_indices, float** vertex_pointer, void** index_pointer, int32_t update = 3);
       virtual void geometry_end(int32_t handle);
       virtual void geometry_draw(int32_t handle, int32_t instance_count);
+      virtual void geometry_draw_batch(const draw_command* commands, int32_t number_of_commands);
+      virtual void transient_geometry_draw(const transient_geometry& tg, int32_t instance_count = 1);
+      virtual void geometry_draw_indirect(int32_t geometry, int32_t command_buffer, int32_t count_buffer, int32_t max_commands);
 
       virtual int32_t add_shader(const char* source, int32_t type, const char* name);
       virtual void remove_shader(int32_t handle);
@@ -92,8 +102,26 @@ namespace RenderDoos
       
     private:
       void _allocate_geometry_buffer(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer);
+      void _allocate_streaming_geometry_buffer(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer); // pointer goes to the ring partition of the current frame
+      void _allocate_mapped_geometry_buffer(geometry_ref& ref, int32_t tuple_size, int32_t count, int32_t type, void** pointer); // pointer goes to shared gpu memory
+      void _unmap_geometry_buffer(geometry_ref& ref, int32_t size);
+      void _create_streaming_storage(buffer_object* buf); // shared storage for MAX_FRAMES_IN_FLIGHT partitions
       void _remove_geometry_buffer(geometry_ref& ref);
-      void _update_geometry_buffer(geometry_ref& ref);
+      bool _resize_buffer_object(buffer_object* buf, int32_t capacity); // new storage with the first min(size, capacity) bytes copied, true if the gpu copies them later in the frame
+      virtual int32_t _get_storage_offset_alignment();
+      virtual void _stage_buffer_object_data(int32_t handle, const uint8_t* data, int32_t size, int32_t offset);
+      virtual void _finish_staging();
+      void _update_geometry_buffer(geometry_ref& ref, int32_t element_size);
+      void _upload_ranges(MTL::Buffer* destination, const uint8_t* source, const dirty_range* ranges, int32_t number_of_ranges); // through a staging buffer, after the render pass when inside one
+      void _flush_pending_uploads();
+      // blit encoder in order with the work encoded so far, on the command buffer of the frame or outside a frame on one of
+      // its own that _end_blit waits for. Not inside a render pass, a compute pass continues in a new encoder.
+      MTL::BlitCommandEncoder* _begin_blit();
+      void _end_blit(MTL::BlitCommandEncoder* p_blit);
+      virtual void _update_geometry_pool(buffer_object* buf, int32_t size);
+      virtual void _geometry_draw(int32_t handle, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance = 0);
+      void _bind_geometry(const geometry_handle* gh); // uniforms, vertices and per instance data
+      void _draw_geometry(const geometry_handle* gh, int32_t first_index, int32_t index_count, int32_t base_vertex, int32_t instance_count, int32_t base_instance);
       
       MTL::RenderPipelineState* _get_render_pipeline_state(int32_t vertex_shader_handle, int32_t fragment_shader_handle, int32_t color_pixel_format, int32_t depth_pixel_format);
       MTL::ComputePipelineState* _get_compute_pipeline_state(int32_t compute_shader_handle);
@@ -109,6 +137,21 @@ namespace RenderDoos
       MTL::CommandBuffer* mp_command_buffer;
       MTL::RenderCommandEncoder* mp_render_command_encoder;
       MTL::ComputeCommandEncoder* mp_compute_command_encoder;
+      MTL::CommandBuffer* mp_blit_command_buffer; // between _begin_blit and _end_blit
+      bool _blit_resumes_compute;
+      int32_t _indirect_buffer; // streaming buffer object with the arguments of the draws at odd 16-bit first indices
+      int32_t _indirect_cursor; // in bytes in the partition of _indirect_frame
+      uint32_t _indirect_frame;
+
+      struct pending_upload // copy of a staging buffer that waits for the end of the render pass
+        {
+        MTL::Buffer* staging;
+        MTL::Buffer* destination;
+        int32_t staging_offset;
+        int32_t destination_offset;
+        int32_t size;
+        };
+      std::vector<pending_upload> _pending_uploads;
       NS::AutoreleasePool* mp_auto_release_pool;
       dispatch_semaphore_t _semaphore;
       std::vector<uint8_t> _raw_uniforms;
@@ -4,6 +4,7 @@
 #include <stdexcept>
 
 #include "types.h"
+#include "render_queue.h"
 #ifdef RENDERDOOS_OPENGL
 #include "render_context_gl.h"
 #endif
@@ -15,7 +16,7 @@
 namespace RenderDoos
   {
 
-  render_engine::render_engine() : _context(nullptr)
+  render_engine::render_engine() : _context(nullptr), _queue(nullptr)
     {
     }
 
@@ -94,9 +95,16 @@ namespace RenderDoos
 
   void render_engine::renderpass_end()
     {
+    if (_queue)
+      _queue->flush(this);
     _context->renderpass_end();
     }
 
+  void render_engine::set_render_queue(render_queue* queue)
+    {
+    _queue = queue;
+    }
+
   bool render_engine::update_texture(int32_t handle, const uint16_t* data)
     {
     return _context->update_texture(handle, data);
@@ -158,9 +166,9 @@ namespace RenderDoos
     _context->bind_texture_to_channel(handle, channel, flags);
     }
 
-  int32_t render_engine::add_geometry(int32_t vertex_declaration_type)
+  int32_t render_engine::add_geometry(int32_t vertex_declaration_type, int32_t index_type, int32_t geometry_flags)
     {
-    return _context->add_geometry(vertex_declaration_type);
+    return _context->add_geometry(vertex_declaration_type, index_type, geometry_flags);
     }
 
   void render_engine::remove_geometry(int32_t handle)
@@ -173,6 +181,36 @@ namespace RenderDoos
     return _context->add_buffer_object(data, size, buffer_type);
     }
 
+  void render_engine::remove_deferred(int32_t resource_type, int32_t handle)
+    {
+    _context->remove_deferred(resource_type, handle);
+    }
+
+  void render_engine::flush_deferred_removals()
+    {
+    _context->flush_deferred_removals();
+    }
+
+  int32_t render_engine::add_texture_shared(int32_t w, int32_t h, int32_t format, const uint8_t* data, int32_t usage_flags)
+    {
+    return _context->add_texture_shared(w, h, format, data, usage_flags);
+    }
+
+  int32_t render_engine::add_buffer_object_shared(const void* data, int32_t size, int32_t buffer_type)
+    {
+    return _context->add_buffer_object_shared(data, size, buffer_type);
+    }
+
+  void render_engine::release_shared(int32_t resource_type, int32_t handle)
+    {
+    _context->release_shared(resource_type, handle);
+    }
+
+  int32_t render_engine::add_buffer_object_from_file(const char* filename, int64_t offset, int64_t size, int32_t buffer_type, double* megabytes_per_second)
+    {
+    return _context->add_buffer_object_from_file(filename, offset, size, buffer_type, megabytes_per_second);
+    }
+
   void render_engine::remove_buffer_object(int32_t handle)
     {
     _context->remove_buffer_object(handle);
@@ -183,6 +221,21 @@ namespace RenderDoos
     _context->copy_buffer_object_data(source_handle, destination_handle, read_offset, write_offset, size);
     }
 
+  void render_engine::reserve_buffer_object(int32_t handle, int32_t capacity)
+    {
+    _context->reserve_buffer_object(handle, capacity);
+    }
+
+  void render_engine::shrink_buffer_object(int32_t handle)
+    {
+    _context->shrink_buffer_object(handle);
+    }
+
+  void render_engine::copy_buffer_object_regions(const buffer_copy_region* regions, int32_t number_of_regions)
+    {
+    _context->copy_buffer_object_regions(regions, number_of_regions);
+    }
+
   const buffer_object* render_engine::get_buffer_object(int32_t handle) const
     {
     return _context->get_buffer_object(handle);
@@ -203,6 +256,21 @@ namespace RenderDoos
     _context->get_data_from_buffer_object(handle, data, size);
     }
 
+  int32_t render_engine::readback_buffer_object(int32_t handle, int32_t size, int32_t offset)
+    {
+    return _context->readback_buffer_object(handle, size, offset);
+    }
+
+  bool render_engine::is_readback_ready(int32_t readback)
+    {
+    return _context->is_readback_ready(readback);
+    }
+
+  void render_engine::finish_readback(int32_t readback, void* data)
+    {
+    _context->finish_readback(readback, data);
+    }
+
   void render_engine::geometry_begin(int32_t handle, int32_t number_of_vertices, int32_t number_of_indices, float** vertex_pointer, void** index_pointer, int32_t update)
     {
     _context->geometry_begin(handle, number_of_vertices, number_of_indices, vertex_pointer, index_pointer, update);
@@ -218,6 +286,81 @@ namespace RenderDoos
     _context->geometry_draw(handle, instance_count);
     }
 
+  int32_t render_engine::add_submesh(int32_t geometry_handle, int32_t first_index, int32_t index_count, int32_t base_vertex)
+    {
+    return _context->add_submesh(geometry_handle, first_index, index_count, base_vertex);
+    }
+
+  void render_engine::remove_submesh(int32_t handle)
+    {
+    _context->remove_submesh(handle);
+    }
+
+  const submesh* render_engine::get_submesh(int32_t handle) const
+    {
+    return _context->get_submesh(handle);
+    }
+
+  void render_engine::submesh_draw(int32_t handle, int32_t instance_count)
+    {
+    _context->submesh_draw(handle, instance_count);
+    }
+
+  void render_engine::geometry_draw_batch(const draw_command* commands, int32_t number_of_commands)
+    {
+    _context->geometry_draw_batch(commands, number_of_commands);
+    }
+
+  bool render_engine::transient_geometry_begin(transient_geometry& tg, int32_t vertex_declaration_type, int32_t number_of_vertices, int32_t number_of_indices, float** vertex_pointer, void** index_pointer, int32_t index_type)
+    {
+    return _context->transient_geometry_begin(tg, vertex_declaration_type, number_of_vertices, number_of_indices, vertex_pointer, index_pointer, index_type);
+    }
+
+  void render_engine::transient_geometry_draw(const transient_geometry& tg, int32_t instance_count)
+    {
+    _context->transient_geometry_draw(tg, instance_count);
+    }
+
+  bool render_engine::get_draw_indirect_command(const draw_command& command, draw_indirect_command& indirect) const
+    {
+    return _context->get_draw_indirect_command(command, indirect);
+    }
+
+  void render_engine::geometry_draw_indirect(int32_t geometry, int32_t command_buffer, int32_t count_buffer, int32_t max_commands)
+    {
+    _context->geometry_draw_indirect(geometry, command_buffer, count_buffer, max_commands);
+    }
+
+  void render_engine::set_geometry_quantization(int32_t handle, const float4& bb_min, const float4& bb_max)
+    {
+    _context->set_geometry_quantization(handle, bb_min, bb_max);
+    }
+
+  void render_engine::set_geometry_instances(int32_t handle, int32_t buffer_handle, int32_t instance_layout)
+    {
+    _context->set_geometry_instances(handle, buffer_handle, instance_layout);
+    }
+
+  const geometry_handle* render_engine::get_geometry(int32_t handle) const
+    {
+    return _context->get_geometry(handle);
+    }
+
+  bool render_engine::set_geometry_buffers(int32_t handle, int32_t vertex_buffer_handle, int32_t number_of_vertices, int32_t index_buffer_handle, int32_t number_of_indices)
+    {
+    return _context->set_geometry_buffers(handle, vertex_buffer_handle, number_of_vertices, index_buffer_handle, number_of_indices);
+    }
+
+  void render_engine::geometry_dirty_range(int32_t handle, int32_t update, int32_t offset, int32_t size)
+    {
+    _context->geometry_dirty_range(handle, update, offset, size);
+    }
+
+  void render_engine::defragment_geometry_pools()
+    {
+    _context->defragment_geometry_pools();
+    }
+
   int32_t render_engine::add_render_buffer()
     {
     return _context->add_render_buffer();
@@ -300,6 +443,31 @@ namespace RenderDoos
     return _context->is_initialized();
     }
 
+  const render_statistics& render_engine::get_statistics() const
+    {
+    return _context->get_statistics();
+    }
+
+  void render_engine::record_batching(int32_t number_of_items, int32_t number_of_draws)
+    {
+    _context->record_batching(number_of_items, number_of_draws);
+    }
+
+  void render_engine::record_pool_request(bool hit)
+    {
+    _context->record_pool_request(hit);
+    }
+
+  uint32_t render_engine::get_frame_index() const
+    {
+    return _context->get_frame_index();
+    }
+
+  uint32_t render_engine::get_geometry_pool_version() const
+    {
+    return _context->get_geometry_pool_version();
+    }
+
   void render_engine::set_model_view_properties(const model_view_properties& props)
     {
     _mv_props = props;
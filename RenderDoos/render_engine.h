@@ -19,6 +19,8 @@ namespace RenderDoos
       };
     };
 
+  class render_queue;
+
   class render_engine
     {
     public:
@@ -33,7 +35,8 @@ namespace RenderDoos
       void frame_begin(render_drawables drawables); // a frame can consist of multiple render passes
       void frame_end(bool wait_until_completed = false);
       void renderpass_begin(const renderpass_descriptor& descr);
-      void renderpass_end();
+      void renderpass_end(); // flushes the render queue first
+      void set_render_queue(render_queue* queue); // nullptr for drawing in the order of the calls
 
       int32_t add_texture(int32_t w, int32_t h, int32_t format, const uint16_t* data, int32_t usage_flags = TEX_USAGE_READ | TEX_USAGE_RENDER_TARGET);
       bool update_texture(int32_t handle, const uint16_t* data);
@@ -54,16 +57,28 @@ namespace RenderDoos
       void get_data_from_texture(int32_t handle, void* data, int32_t size);
       void copy_texture_data(int32_t source_handle, int32_t destination_handle);
 
-      int32_t add_geometry(int32_t vertex_declaration_type); // VERTEX_STANDARD or VERTEX_COMPACT or VERTEX_COLOR
+      int32_t add_geometry(int32_t vertex_declaration_type, int32_t index_type = INDEX_TYPE_32, int32_t geometry_flags = 0); // VERTEX_STANDARD or VERTEX_COMPACT or VERTEX_COLOR
       void remove_geometry(int32_t handle);
 
       int32_t add_buffer_object(const void* data, int32_t size, int32_t buffer_type = COMPUTE_BUFFER);
       void remove_buffer_object(int32_t handle);
+      void remove_deferred(int32_t resource_type, int32_t handle); // RESOURCE_TEXTURE, RESOURCE_GEOMETRY, RESOURCE_BUFFER_OBJECT or RESOURCE_FRAME_BUFFER, released when the gpu is done with it
+      void flush_deferred_removals();
+      int32_t add_texture_shared(int32_t w, int32_t h, int32_t format, const uint8_t* data, int32_t usage_flags = TEX_USAGE_READ | TEX_USAGE_RENDER_TARGET);
+      int32_t add_buffer_object_shared(const void* data, int32_t size, int32_t buffer_type = COMPUTE_BUFFER);
+      void release_shared(int32_t resource_type, int32_t handle); // RESOURCE_TEXTURE or RESOURCE_BUFFER_OBJECT, removes the resource with the last reference
+      int32_t add_buffer_object_from_file(const char* filename, int64_t offset = 0, int64_t size = -1, int32_t buffer_type = COMPUTE_BUFFER, double* megabytes_per_second = nullptr);
       void update_buffer_object(int32_t handle, const void* data, int32_t size, int32_t offset = 0);
       void bind_buffer_object(int32_t handle, int32_t channel, int32_t target = BIND_TO_DEFAULT);
       void get_data_from_buffer_object(int32_t handle, void* data, int32_t size);
+      int32_t readback_buffer_object(int32_t handle, int32_t size, int32_t offset = 0);
+      bool is_readback_ready(int32_t readback);
+      void finish_readback(int32_t readback, void* data);
       const buffer_object* get_buffer_object(int32_t handle) const;
       void copy_buffer_object_data(int32_t source_handle, int32_t destination_handle, uint32_t read_offset, uint32_t write_offset, uint32_t size);
+      void reserve_buffer_object(int32_t handle, int32_t capacity);
+      void shrink_buffer_object(int32_t handle);
+      void copy_buffer_object_regions(const buffer_copy_region* regions, int32_t number_of_regions);
 
       void dispatch_compute(int32_t num_groups_x, int32_t num_groups_y, int32_t num_groups_z, int32_t local_size_x, int32_t local_size_y, int32_t local_size_z);
 
@@ -78,6 +93,25 @@ namespace RenderDoos
       void geometry_end(int32_t handle);
       void geometry_draw(int32_t handle, int32_t instance_count = 1);
 
+      int32_t add_submesh(int32_t geometry_handle, int32_t first_index, int32_t index_count, int32_t base_vertex = 0); // a range of the indices of a geometry
+      void remove_submesh(int32_t handle);
+      const submesh* get_submesh(int32_t handle) const;
+      void submesh_draw(int32_t handle, int32_t instance_count = 1);
+      void geometry_draw_batch(const draw_command* commands, int32_t number_of_commands);
+
+      // vertices and indices valid until frame_end, for geometry that is rebuilt every frame
+      bool transient_geometry_begin(transient_geometry& tg, int32_t vertex_declaration_type, int32_t number_of_vertices, int32_t number_of_indices, float** vertex_pointer, void** index_pointer, int32_t index_type = INDEX_TYPE_32);
+      void transient_geometry_draw(const transient_geometry& tg, int32_t instance_count = 1);
+      bool get_draw_indirect_command(const draw_command& command, draw_indirect_command& indirect) const;
+      void geometry_draw_indirect(int32_t geometry, int32_t command_buffer, int32_t count_buffer, int32_t max_commands);
+
+      void set_geometry_quantization(int32_t handle, const float4& bb_min, const float4& bb_max); // bounding box used by quantize_vertices
+      void set_geometry_instances(int32_t handle, int32_t buffer_handle, int32_t instance_layout = INSTANCE_MATRIX); // per instance data, -1 detaches
+      const geometry_handle* get_geometry(int32_t handle) const;
+      bool set_geometry_buffers(int32_t handle, int32_t vertex_buffer_handle, int32_t number_of_vertices, int32_t index_buffer_handle, int32_t number_of_indices); // compute buffers as vertex and index source
+      void geometry_dirty_range(int32_t handle, int32_t update, int32_t offset, int32_t size); // byte range changed since geometry_begin
+      void defragment_geometry_pools(); // between frames
+
       int32_t add_shader(const char* source, int32_t type, const char* name);
       void remove_shader(int32_t handle);
 
@@ -98,6 +132,12 @@ namespace RenderDoos
 
       bool is_initialized() const;
 
+      const render_statistics& get_statistics() const; // statistics of the last finished frame
+      void record_batching(int32_t number_of_items, int32_t number_of_draws);
+      void record_pool_request(bool hit);
+      uint32_t get_frame_index() const;
+      uint32_t get_geometry_pool_version() const;
+
       void set_model_view_properties(const model_view_properties& props);
 
       const float4x4& get_view_project() const { return _last_view_project; }
@@ -118,6 +158,7 @@ namespace RenderDoos
 
     private:
       render_context* _context;
+      render_queue* _queue;
       float4x4 _last_projection, _last_camera, _last_view_project;
       model_view_properties _mv_props;
       renderer_type::backend _vendor;
@@ -0,0 +1,260 @@
+#include "render_queue.h"
+#include "render_engine.h"
+#include "material.h"
+#include <algorithm>
+#include <cstring>
+
+namespace RenderDoos
+  {
+
+  namespace
+    {
+    uint32_t depth_bits(float depth) // 24 most significant bits of a non negative float keep its order
+      {
+      if (!(depth > 0.f))
+        return 0;
+      uint32_t bits;
+      memcpy(&bits, &depth, sizeof(float));
+      return bits >> 7;
+      }
+    }
+
+  render_queue::render_queue() : instance_buffer_handle(-1), instance_capacity(0), instance_cursor(0), instance_frame(0)
+    {
+    }
+
+  render_queue::~render_queue()
+    {
+    }
+
+  void render_queue::add(material* mat, int32_t geometry_handle, float depth, int32_t flags, int32_t pass, int32_t instance_count)
+    {
+    draw_command command;
+    command.geometry = geometry_handle;
+    command.first_index = 0;
+    command.index_count = -1;
+    command.base_vertex = 0;
+    command.instance_count = instance_count;
+    command.base_instance = 0;
+    add(mat, command, depth, flags, pass);
+    }
+
+  void render_queue::add(material* mat, const draw_command& command, float depth, int32_t flags, int32_t pass)
+    {
+    draw_item item;
+    item.mat = mat;
+    item.command = command;
+    item.depth = depth;
+    item.flags = flags;
+    item.pass = pass;
+    item.instance = -1;
+    item.view = views.empty() ? -1 : (int32_t)views.size() - 1;
+    items.push_back(item);
+    }
+
+  void render_queue::add(material* mat, int32_t geometry_handle, const float4x4& model, float depth, int32_t flags, int32_t pass)
+    {
+    add(mat, geometry_handle, depth, flags, pass, 1);
+    items.back().instance = (int32_t)models.size();
+    models.push_back(model);
+    }
+
+  void render_queue::set_model_view_properties(const model_view_properties& props)
+    {
+    views.push_back(props);
+    }
+
+  void render_queue::clear()
+    {
+    items.clear();
+    models.clear();
+    views.clear();
+    }
+
+  void render_queue::destroy(render_engine* engine)
+    {
+    clear();
+    if (instance_buffer_handle >= 0) // draws of the frames in flight may still read it
+      engine->remove_deferred(RESOURCE_BUFFER_OBJECT, instance_buffer_handle);
+    instance_buffer_handle = -1;
+    instance_capacity = 0;
+    instance_cursor = 0;
+    }
+
+  uint64_t render_queue::_make_key(const draw_item& item) const
+    {
+    uint64_t pass = (uint64_t)(item.pass & 255);
+    uint64_t program = (uint64_t)((item.mat->get_program() + 1) & 2047); // 11 bits, MAX_SHADER_PROGRAM
+    uint64_t texture = (uint64_t)((item.mat->get_texture() + 1) & 8191); // 13 bits, MAX_TEXTURE
+    uint64_t depth = (uint64_t)depth_bits(item.depth);
+    if (item.flags & RENDER_QUEUE_TRANSLUCENT)
+      return (pass << 56) | (1ull << 55) | ((0xffffffull - depth) << 31) | (program << 20) | (texture << 7);
+    uint64_t geometry = (uint64_t)(item.command.geometry & 1023); // 10 bits, MAX_GEOMETRY, keeps equal geometries together for instancing
+    return (pass << 56) | (program << 44) | (texture << 31) | (geometry << 21) | (depth >> 3);
+    }
+
+  void render_queue::_sort()
+    {
+    const uint32_t n = (uint32_t)items.size();
+    keys.resize(n);
+    keys_temp.resize(n);
+    order.resize(n);
+    order_temp.resize(n);
+    for (uint32_t i = 0; i < n; ++i)
+      {
+      keys[i] = _make_key(items[i]);
+      order[i] = i;
+      }
+    uint32_t histogram[256];
+    for (uint32_t shift = 0; shift < 64; shift += 8)
+      {
+      memset(histogram, 0, sizeof(histogram));
+      for (uint32_t i = 0; i < n; ++i)
+        ++histogram[(keys[i] >> shift) & 255];
+      if (histogram[(keys[0] >> shift) & 255] == n) // all keys share this byte
+        continue;
+      uint32_t offset = 0;
+      for (uint32_t b = 0; b < 256; ++b)
+        {
+        uint32_t count = histogram[b];
+        histogram[b] = offset;
+        offset += count;
+        }
+      for (uint32_t i = 0; i < n; ++i)
+        {
+        uint32_t destination = histogram[(keys[i] >> shift) & 255]++;
+        keys_temp[destination] = keys[i];
+        order_temp[destination] = order[i];
+        }
+      keys.swap(keys_temp);
+      order.swap(order_temp);
+      }
+    }
+
+  namespace
+    {
+    bool can_instance(const draw_item& first, const draw_item& other)
+      {
+      return other.instance >= 0 && other.mat == first.mat && other.flags == first.flags && other.pass == first.pass && other.view == first.view &&
+        other.command.geometry == first.command.geometry && other.command.first_index == first.command.first_index &&
+        other.command.index_count == first.command.index_count && other.command.base_vertex == first.command.base_vertex;
+      }
+    }
+
+  void render_queue::_upload_instances(render_engine* engine)
+    {
+    if (engine->get_frame_index() != instance_frame) // the ring partition of a new frame
+      {
+      instance_frame = engine->get_frame_index();
+      instance_cursor = 0;
+      }
+    int32_t needed = instance_cursor + (int32_t)instances.size();
+    if (needed > instance_capacity)
+      {
+      // earlier draws of this frame keep the old buffer alive until the gpu is done
+      if (instance_buffer_handle >= 0)
+        engine->remove_deferred(RESOURCE_BUFFER_OBJECT, instance_buffer_handle);
+      instance_capacity = std::max<int32_t>(needed, instance_capacity * 2);
+      instance_capacity = std::max<int32_t>(instance_capacity, 256);
+      instance_buffer_handle = engine->add_buffer_object(nullptr, instance_capacity * sizeof(float4x4), COMPUTE_BUFFER | BUFFER_STREAMING);
+      instance_cursor = 0;
+      }
+    engine->update_buffer_object(instance_buffer_handle, instances.data(), (int32_t)(instances.size() * sizeof(float4x4)), instance_cursor * sizeof(float4x4));
+    }
+
+  void render_queue::flush(render_engine* engine)
+    {
+    if (items.empty())
+      return;
+    _sort();
+
+    // merge consecutive instanced items, base_instance is relative to the matrices of this flush until they are placed
+    batches.clear();
+    instances.clear();
+    size_t i = 0;
+    while (i < items.size())
+      {
+      draw_item batch = items[order[i]];
+      ++i;
+      if (batch.instance >= 0)
+        {
+        batch.command.base_instance = (int32_t)instances.size();
+        batch.command.instance_count = 1;
+        instances.push_back(models[batch.instance]);
+        while (i < items.size() && can_instance(batch, items[order[i]]))
+          {
+          instances.push_back(models[items[order[i]].instance]);
+          ++batch.command.instance_count;
+          ++i;
+          }
+        }
+      batches.push_back(batch);
+      }
+    if (!instances.empty())
+      {
+      _upload_instances(engine);
+      for (auto& batch : batches)
+        {
+        if (batch.instance < 0)
+          continue;
+        batch.command.base_instance += instance_cursor;
+        }
+      instance_cursor += (int32_t)instances.size();
+      }
+    engine->record_batching((int32_t)items.size(), (int32_t)batches.size());
+
+    bool blending = false;
+    const model_view_properties engine_view = engine->get_model_view_properties(); // restored after the items
+    int32_t view = -1;
+    i = 0;
+    while (i < batches.size())
+      {
+      const draw_item& first = batches[i];
+      bool translucent = (first.flags & RENDER_QUEUE_TRANSLUCENT) != 0;
+      if (translucent != blending)
+        {
+        engine->set_blending_enabled(translucent);
+        blending = translucent;
+        }
+      if (first.view != view) // before the bind, as materials read the camera of the engine
+        {
+        engine->set_model_view_properties(first.view >= 0 ? views[first.view] : engine_view);
+        view = first.view;
+        }
+      first.mat->bind(engine);
+      commands.clear();
+      size_t end = i;
+      while (end < batches.size() && batches[end].mat == first.mat && ((batches[end].flags & RENDER_QUEUE_TRANSLUCENT) != 0) == translucent && batches[end].view == view)
+        {
+        if (batches[end].instance >= 0)
+          {
+          // the instance buffer is attached for this draw only, the geometry keeps the instance data of its owner
+          if (!commands.empty())
+            engine->geometry_draw_batch(commands.data(), (int32_t)commands.size());
+          commands.clear();
+          const geometry_handle* gh = engine->get_geometry(batches[end].command.geometry);
+          if (gh)
+            {
+            int32_t previous_buffer = gh->instance_buffer;
+            int32_t previous_layout = gh->instance_layout;
+            engine->set_geometry_instances(batches[end].command.geometry, instance_buffer_handle, INSTANCE_MATRIX);
+            engine->geometry_draw_batch(&batches[end].command, 1);
+            engine->set_geometry_instances(batches[end].command.geometry, previous_buffer, previous_buffer >= 0 ? previous_layout : INSTANCE_MATRIX);
+            }
+          }
+        else
+          commands.push_back(batches[end].command);
+        ++end;
+        }
+      if (!commands.empty())
+        engine->geometry_draw_batch(commands.data(), (int32_t)commands.size());
+      i = end;
+      }
+    if (blending)
+      engine->set_blending_enabled(false);
+    if (view >= 0)
+      engine->set_model_view_properties(engine_view);
+    clear();
+    }
+
+  }
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "float.h"
+#include "render_context.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+  class material;
+
+#define RENDER_QUEUE_TRANSLUCENT 1 // drawn after the opaque items of its pass, back to front with blending enabled
+
+  struct draw_item
+    {
+    material* mat;
+    draw_command command;
+    float depth;   // view space distance
+    int32_t flags; // RENDER_QUEUE_TRANSLUCENT
+    int32_t pass;  // 0..255, lower passes are drawn first
+    int32_t instance; // index of the model matrix, -1 for items without per draw data
+    int32_t view;     // index of the model view properties of the queue, -1 for the properties of the engine at flush
+    };
+
+  // collects the draws of a renderpass and submits them sorted on a 64-bit key: pass, translucency, program, texture,
+  // geometry and depth for opaque items, or pass, translucency, depth, program and texture for translucent items.
+  // Consecutive items with the same material are bound once and drawn with one geometry_draw_batch. Consecutive items
+  // with a model matrix that share material and geometry range become one instanced draw: their matrices go to a
+  // transient instance buffer that is attached to the geometry with set_geometry_instances (INSTANCE_MATRIX) for that
+  // draw only, so compile their materials with MATERIAL_VARIANT_INSTANCED.
+  // Materials read the camera of the engine when they are bound, so each item keeps the model view properties given to
+  // set_model_view_properties before it was added. Items added before the first call are drawn with the camera that is
+  // current at flush, so their geometry has to be in world space or carry a model matrix.
+  class render_queue
+    {
+    public:
+      render_queue();
+      ~render_queue();
+
+      void add(material* mat, int32_t geometry_handle, float depth, int32_t flags = 0, int32_t pass = 0, int32_t instance_count = 1);
+      void add(material* mat, const draw_command& command, float depth, int32_t flags = 0, int32_t pass = 0);
+      void add(material* mat, int32_t geometry_handle, const float4x4& model, float depth, int32_t flags = 0, int32_t pass = 0);
+
+      void set_model_view_properties(const model_view_properties& props); // for the items added next, until clear
+
+      void flush(render_engine* engine); // sorts, draws and clears the items, called by render_engine::renderpass_end when set
+      void clear();
+      void destroy(render_engine* engine); // removes the transient instance buffer
+
+      int32_t size() const { return (int32_t)items.size(); }
+
+    private:
+      uint64_t _make_key(const draw_item& item) const;
+      void _sort(); // radix sort of keys with order as payload
+      void _upload_instances(render_engine* engine);
+
+    private:
+      std::vector<draw_item> items;
+      std::vector<uint64_t> keys, keys_temp;
+      std::vector<uint32_t> order, order_temp;
+      std::vector<draw_command> commands;
+      std::vector<draw_item> batches; // sorted items with the instanced items merged
+      std::vector<float4x4> models, instances;
+      std::vector<model_view_properties> views;
+      int32_t instance_buffer_handle;
+      int32_t instance_capacity; // in matrices
+      int32_t instance_cursor;   // first free matrix of the current frame
+      uint32_t instance_frame;
+    };
+
+  }
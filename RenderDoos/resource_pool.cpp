@@ -0,0 +1,154 @@
+#include "resource_pool.h"
+#include "render_engine.h"
+
+namespace RenderDoos
+  {
+
+  namespace
+    {
+    uint64_t acquired_id(int32_t type, int32_t handle)
+      {
+      return ((uint64_t)(uint32_t)type << 32) | (uint32_t)handle;
+      }
+
+    int32_t get_size_class(int32_t size)
+      {
+      int32_t size_class = 256;
+      while (size_class < size && size_class < (1 << 30))
+        size_class *= 2;
+      return size_class;
+      }
+    }
+
+  resource_pool::resource_pool()
+    {
+    }
+
+  resource_pool::~resource_pool()
+    {
+    }
+
+  int32_t resource_pool::_acquire(render_engine* engine, const pool_key& key)
+    {
+    for (size_t i = 0; i < pooled.size(); ++i)
+      {
+      if (pooled[i].key == key)
+        {
+        int32_t handle = pooled[i].handle;
+        pooled[i] = pooled.back();
+        pooled.pop_back();
+        acquired[acquired_id(key.type, handle)] = key;
+        engine->record_pool_request(true);
+        return handle;
+        }
+      }
+    engine->record_pool_request(false);
+    int32_t handle = -1;
+    switch (key.type)
+      {
+      case RESOURCE_TEXTURE:
+        handle = engine->add_texture(key.w, key.h, key.format, (const uint8_t*)nullptr, key.usage_flags);
+        break;
+      case RESOURCE_FRAME_BUFFER:
+        handle = engine->add_frame_buffer(key.w, key.h, key.format != 0, key.usage_flags);
+        break;
+      case RESOURCE_BUFFER_OBJECT:
+        handle = engine->add_buffer_object(nullptr, key.w, key.format);
+        break;
+      default:
+        break;
+      }
+    if (handle >= 0)
+      acquired[acquired_id(key.type, handle)] = key;
+    return handle;
+    }
+
+  void resource_pool::_release(render_engine* engine, int32_t type, int32_t handle)
+    {
+    auto it = acquired.find(acquired_id(type, handle));
+    if (it == acquired.end())
+      return;
+    pooled_resource resource;
+    resource.key = it->second;
+    resource.handle = handle;
+    resource.released_frame = engine->get_frame_index();
+    pooled.push_back(resource);
+    acquired.erase(it);
+    }
+
+  int32_t resource_pool::acquire_texture(render_engine* engine, int32_t w, int32_t h, int32_t format, int32_t usage_flags)
+    {
+    pool_key key;
+    key.type = RESOURCE_TEXTURE;
+    key.w = w;
+    key.h = h;
+    key.format = format;
+    key.usage_flags = usage_flags;
+    return _acquire(engine, key);
+    }
+
+  int32_t resource_pool::acquire_frame_buffer(render_engine* engine, int32_t w, int32_t h, bool make_depth_texture, int32_t usage_flags)
+    {
+    pool_key key;
+    key.type = RESOURCE_FRAME_BUFFER;
+    key.w = w;
+    key.h = h;
+    key.format = make_depth_texture ? 1 : 0;
+    key.usage_flags = usage_flags;
+    return _acquire(engine, key);
+    }
+
+  int32_t resource_pool::acquire_buffer_object(render_engine* engine, int32_t size, int32_t buffer_type)
+    {
+    if (size <= 0)
+      return -1;
+    pool_key key;
+    key.type = RESOURCE_BUFFER_OBJECT;
+    key.w = get_size_class(size);
+    key.h = 0;
+    key.format = buffer_type;
+    key.usage_flags = 0;
+    return _acquire(engine, key);
+    }
+
+  void resource_pool::release_texture(render_engine* engine, int32_t handle)
+    {
+    _release(engine, RESOURCE_TEXTURE, handle);
+    }
+
+  void resource_pool::release_frame_buffer(render_engine* engine, int32_t handle)
+    {
+    _release(engine, RESOURCE_FRAME_BUFFER, handle);
+    }
+
+  void resource_pool::release_buffer_object(render_engine* engine, int32_t handle)
+    {
+    _release(engine, RESOURCE_BUFFER_OBJECT, handle);
+    }
+
+  void resource_pool::end_frame(render_engine* engine, uint32_t max_idle_frames)
+    {
+    uint32_t frame = engine->get_frame_index();
+    size_t i = 0;
+    while (i < pooled.size())
+      {
+      if (frame - pooled[i].released_frame > max_idle_frames)
+        {
+        engine->remove_deferred(pooled[i].key.type, pooled[i].handle);
+        pooled[i] = pooled.back();
+        pooled.pop_back();
+        }
+      else
+        ++i;
+      }
+    }
+
+  void resource_pool::destroy(render_engine* engine)
+    {
+    for (const auto& resource : pooled)
+      engine->remove_deferred(resource.key.type, resource.handle);
+    pooled.clear();
+    acquired.clear();
+    }
+
+  }
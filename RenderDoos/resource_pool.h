@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "render_context.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+
+  // recycles released textures, frame buffers and buffer objects instead of removing them. Textures are matched on width,
+  // height, format and usage, frame buffers on width, height, depth texture and usage, and buffer objects on buffer type
+  // and size class, the next power of two of at least 256 bytes. Resources that stay unused for max_idle_frames are
+  // removed with remove_deferred in end_frame. Each acquire counts as a pool hit or miss in the render statistics.
+  class resource_pool
+    {
+    public:
+      resource_pool();
+      ~resource_pool();
+
+      int32_t acquire_texture(render_engine* engine, int32_t w, int32_t h, int32_t format, int32_t usage_flags = TEX_USAGE_READ | TEX_USAGE_RENDER_TARGET);
+      int32_t acquire_frame_buffer(render_engine* engine, int32_t w, int32_t h, bool make_depth_texture, int32_t usage_flags = TEX_USAGE_READ | TEX_USAGE_RENDER_TARGET);
+      int32_t acquire_buffer_object(render_engine* engine, int32_t size, int32_t buffer_type = COMPUTE_BUFFER); // the buffer has the size of its size class
+
+      // the contents of a recycled resource are undefined. Handles that did not come from this pool are ignored.
+      void release_texture(render_engine* engine, int32_t handle);
+      void release_frame_buffer(render_engine* engine, int32_t handle);
+      void release_buffer_object(render_engine* engine, int32_t handle);
+
+      void end_frame(render_engine* engine, uint32_t max_idle_frames = 8); // evicts the resources that stayed unused too long
+      void destroy(render_engine* engine); // removes the pooled resources, acquired ones are left to their owners
+
+      int32_t get_number_of_pooled() const { return (int32_t)pooled.size(); }
+
+    private:
+      struct pool_key
+        {
+        int32_t type;   // RESOURCE_TEXTURE or RESOURCE_FRAME_BUFFER or RESOURCE_BUFFER_OBJECT
+        int32_t w, h;   // the size class of a buffer object in w
+        int32_t format; // the buffer type of a buffer object, 1 if a frame buffer has a depth texture
+        int32_t usage_flags;
+        bool operator == (const pool_key& other) const
+          {
+          return type == other.type && w == other.w && h == other.h && format == other.format && usage_flags == other.usage_flags;
+          }
+        };
+
+      struct pooled_resource
+        {
+        pool_key key;
+        int32_t handle;
+        uint32_t released_frame;
+        };
+
+      int32_t _acquire(render_engine* engine, const pool_key& key);
+      void _release(render_engine* engine, int32_t type, int32_t handle);
+
+    private:
+      std::vector<pooled_resource> pooled; // released resources, a linear search is fine for the few dozen a chain uses
+      std::map<uint64_t, pool_key> acquired; // (type << 32) | handle
+    };
+
+  }
@@ -101,6 +101,137 @@ fragment float4 simple_material_fragment_shader(const VertexOut vertexIn [[stage
   return (texture.sample(sampler2d, vertexIn.texcoord)*input.texture_sample + input.color*(1-input.texture_sample))*l;
 }
 
+struct QuantizationConstants {
+  float4 offset;
+  float4 extent;
+};
+
+float3 decode_position(ushort4 p, constant QuantizationConstants& q) {
+  return q.offset.xyz + q.extent.xyz * (float3(p.xyz) / 65535.0);
+}
+
+float3 decode_octahedral(short2 e) {
+  float2 f = max(float2(e) / 32767.0, -1.0);
+  float3 n = float3(f, 1.0 - abs(f.x) - abs(f.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+struct VertexCompactQuantizedIn {
+  packed_ushort4 position;
+  int color;
+};
+
+vertex VertexCompactOut compact_material_quantized_vertex_shader(const device VertexCompactQuantizedIn *vertices [[buffer(0)]], uint vertexId [[vertex_id]], constant CompactMaterialUniforms& input [[buffer(10)]], constant QuantizationConstants& quantization [[buffer(11)]]) {
+  float4 pos(decode_position(vertices[vertexId].position, quantization), 1);
+  VertexCompactOut out;
+  out.position = input.view_projection_matrix * pos;
+  int color = vertices[vertexId].color;
+  out.color = float4(float(color&uint(255))/255.f, float((color>>8)&uint(255))/255.f, float((color>>16)&uint(255))/255.f, float((color>>24)&uint(255))/255.f);
+  return out;
+}
+
+struct VertexColoredQuantizedIn {
+  packed_ushort4 position;
+  packed_short2 normal;
+  int color;
+};
+
+vertex VertexColoredOut vertex_colored_material_quantized_vertex_shader(const device VertexColoredQuantizedIn *vertices [[buffer(0)]], uint vertexId [[vertex_id]], constant VertexColoredMaterialUniforms& input [[buffer(10)]], constant QuantizationConstants& quantization [[buffer(11)]]) {
+  float4 pos(decode_position(vertices[vertexId].position, quantization), 1);
+  VertexColoredOut out;
+  out.position = input.view_projection_matrix * pos;
+  out.normal = (input.camera_matrix * float4(decode_octahedral(vertices[vertexId].normal), 0)).xyz;
+  int color = vertices[vertexId].color;
+  out.color = float4(float(color&uint(255))/255.f, float((color>>8)&uint(255))/255.f, float((color>>16)&uint(255))/255.f, float((color>>24)&uint(255))/255.f);
+  return out;
+}
+
+struct VertexQuantizedIn {
+  packed_ushort4 position;
+  packed_short2 normal;
+  packed_half2 textureCoordinates;
+};
+
+vertex VertexOut simple_material_quantized_vertex_shader(const device VertexQuantizedIn *vertices [[buffer(0)]], uint vertexId [[vertex_id]], constant SimpleMaterialUniforms& input [[buffer(10)]], constant QuantizationConstants& quantization [[buffer(11)]]) {
+  float4 pos(decode_position(vertices[vertexId].position, quantization), 1);
+  VertexOut out;
+  out.position = input.view_projection_matrix * pos;
+  out.normal = (input.camera_matrix * float4(decode_octahedral(vertices[vertexId].normal), 0)).xyz;
+  out.texcoord = float2(vertices[vertexId].textureCoordinates);
+  return out;
+}
+
+struct InstanceConstants {
+  uint stride; // size of one instance in bytes
+};
+
+float4x4 instance_model(const device uchar* instances, uint instanceId, constant InstanceConstants& instancing) {
+  return *(const device float4x4*)(instances + instanceId * instancing.stride);
+}
+
+vertex VertexCompactOut compact_material_instanced_vertex_shader(const device VertexCompactIn *vertices [[buffer(0)]], const device uchar *instances [[buffer(1)]], uint vertexId [[vertex_id]], uint instanceId [[instance_id]], constant CompactMaterialUniforms& input [[buffer(10)]], constant InstanceConstants& instancing [[buffer(12)]]) {
+  float4 pos = instance_model(instances, instanceId, instancing) * float4(vertices[vertexId].position, 1);
+  VertexCompactOut out;
+  out.position = input.view_projection_matrix * pos;
+  int color = vertices[vertexId].color;
+  out.color = float4(float(color&uint(255))/255.f, float((color>>8)&uint(255))/255.f, float((color>>16)&uint(255))/255.f, float((color>>24)&uint(255))/255.f);
+  return out;
+}
+
+vertex VertexCompactOut compact_material_quantized_instanced_vertex_shader(const device VertexCompactQuantizedIn *vertices [[buffer(0)]], const device uchar *instances [[buffer(1)]], uint vertexId [[vertex_id]], uint instanceId [[instance_id]], constant CompactMaterialUniforms& input [[buffer(10)]], constant QuantizationConstants& quantization [[buffer(11)]], constant InstanceConstants& instancing [[buffer(12)]]) {
+  float4 pos = instance_model(instances, instanceId, instancing) * float4(decode_position(vertices[vertexId].position, quantization), 1);
+  VertexCompactOut out;
+  out.position = input.view_projection_matrix * pos;
+  int color = vertices[vertexId].color;
+  out.color = float4(float(color&uint(255))/255.f, float((color>>8)&uint(255))/255.f, float((color>>16)&uint(255))/255.f, float((color>>24)&uint(255))/255.f);
+  return out;
+}
+
+vertex VertexColoredOut vertex_colored_material_instanced_vertex_shader(const device VertexColoredIn *vertices [[buffer(0)]], const device uchar *instances [[buffer(1)]], uint vertexId [[vertex_id]], uint instanceId [[instance_id]], constant VertexColoredMaterialUniforms& input [[buffer(10)]], constant InstanceConstants& instancing [[buffer(12)]]) {
+  float4x4 model = instance_model(instances, instanceId, instancing);
+  float4 pos = model * float4(vertices[vertexId].position, 1);
+  VertexColoredOut out;
+  out.position = input.view_projection_matrix * pos;
+  out.normal = (input.camera_matrix * (model * float4(vertices[vertexId].normal, 0))).xyz;
+  int color = vertices[vertexId].color;
+  out.color = float4(float(color&uint(255))/255.f, float((color>>8)&uint(255))/255.f, float((color>>16)&uint(255))/255.f, float((color>>24)&uint(255))/255.f);
+  return out;
+}
+
+vertex VertexColoredOut vertex_colored_material_quantized_instanced_vertex_shader(const device VertexColoredQuantizedIn *vertices [[buffer(0)]], const device uchar *instances [[buffer(1)]], uint vertexId [[vertex_id]], uint instanceId [[instance_id]], constant VertexColoredMaterialUniforms& input [[buffer(10)]], constant QuantizationConstants& quantization [[buffer(11)]], constant InstanceConstants& instancing [[buffer(12)]]) {
+  float4x4 model = instance_model(instances, instanceId, instancing);
+  float4 pos = model * float4(decode_position(vertices[vertexId].position, quantization), 1);
+  VertexColoredOut out;
+  out.position = input.view_projection_matrix * pos;
+  out.normal = (input.camera_matrix * (model * float4(decode_octahedral(vertices[vertexId].normal), 0))).xyz;
+  int color = vertices[vertexId].color;
+  out.color = float4(float(color&uint(255))/255.f, float((color>>8)&uint(255))/255.f, float((color>>16)&uint(255))/255.f, float((color>>24)&uint(255))/255.f);
+  return out;
+}
+
+vertex VertexOut simple_material_instanced_vertex_shader(const device VertexIn *vertices [[buffer(0)]], const device uchar *instances [[buffer(1)]], uint vertexId [[vertex_id]], uint instanceId [[instance_id]], constant SimpleMaterialUniforms& input [[buffer(10)]], constant InstanceConstants& instancing [[buffer(12)]]) {
+  float4x4 model = instance_model(instances, instanceId, instancing);
+  float4 pos = model * float4(vertices[vertexId].position, 1);
+  VertexOut out;
+  out.position = input.view_projection_matrix * pos;
+  out.normal = (input.camera_matrix * (model * float4(vertices[vertexId].normal, 0))).xyz;
+  out.texcoord = vertices[vertexId].textureCoordinates;
+  return out;
+}
+
+vertex VertexOut simple_material_quantized_instanced_vertex_shader(const device VertexQuantizedIn *vertices [[buffer(0)]], const device uchar *instances [[buffer(1)]], uint vertexId [[vertex_id]], uint instanceId [[instance_id]], constant SimpleMaterialUniforms& input [[buffer(10)]], constant QuantizationConstants& quantization [[buffer(11)]], constant InstanceConstants& instancing [[buffer(12)]]) {
+  float4x4 model = instance_model(instances, instanceId, instancing);
+  float4 pos = model * float4(decode_position(vertices[vertexId].position, quantization), 1);
+  VertexOut out;
+  out.position = input.view_projection_matrix * pos;
+  out.normal = (input.camera_matrix * (model * float4(decode_octahedral(vertices[vertexId].normal), 0))).xyz;
+  out.texcoord = float2(vertices[vertexId].textureCoordinates);
+  return out;
+}
+
 struct ShadertoyMaterialUniforms {
   float4x4 view_projection_matrix;
   float3 iResolution;
@@ -130,3 +261,55 @@ fragment float4 shadertoy_material_fragment_shader(const VertexOut vertexIn [[st
   return float4(fragColor[0], fragColor[1], fragColor[2], 1);
 }
 */
+
+struct DrawIndirectCommand {
+  uint index_count;
+  uint instance_count;
+  uint first_index;
+  int base_vertex;
+  uint base_instance;
+};
+
+struct CullObject {
+  float4 bb_min;
+  float4 bb_max;
+  DrawIndirectCommand command;
+  uint padding[3];
+};
+
+struct CullingUniforms {
+  float4x4 view_projection_matrix;
+  int number_of_objects;
+};
+
+struct CullingClearUniforms {
+  int number_of_objects;
+};
+
+kernel void culling_clear_kernel(device DrawIndirectCommand *commands [[buffer(1)]], device atomic_uint *count [[buffer(2)]], constant CullingClearUniforms& input [[buffer(10)]], uint id [[thread_position_in_grid]]) {
+  if (id == 0)
+    atomic_store_explicit(count, 0, memory_order_relaxed);
+  if (id < uint(input.number_of_objects))
+    commands[id].instance_count = 0;
+}
+
+bool is_visible(float3 bb_min, float3 bb_max, float4x4 view_projection) {
+  float3 outside_low = float3(0);
+  float3 outside_high = float3(0);
+  for (int i = 0; i < 8; ++i) {
+    float3 corner = float3((i & 1) != 0 ? bb_max.x : bb_min.x, (i & 2) != 0 ? bb_max.y : bb_min.y, (i & 4) != 0 ? bb_max.z : bb_min.z);
+    float4 p = view_projection * float4(corner, 1);
+    outside_low += select(float3(0), float3(1), bool3(p.x < -p.w, p.y < -p.w, p.z < 0)); // metal clip z is in [0, w]
+    outside_high += select(float3(0), float3(1), p.xyz > float3(p.w));
+  }
+  return all(outside_low < float3(8)) && all(outside_high < float3(8));
+}
+
+kernel void culling_kernel(const device CullObject *objects [[buffer(0)]], device DrawIndirectCommand *commands [[buffer(1)]], device atomic_uint *count [[buffer(2)]], constant CullingUniforms& input [[buffer(10)]], uint id [[thread_position_in_grid]]) {
+  if (id >= uint(input.number_of_objects))
+    return;
+  if (is_visible(objects[id].bb_min.xyz, objects[id].bb_max.xyz, input.view_projection_matrix)) {
+    uint slot = atomic_fetch_add_explicit(count, 1, memory_order_relaxed);
+    commands[slot] = objects[id].command;
+  }
+}
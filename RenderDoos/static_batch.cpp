@@ -0,0 +1,197 @@
+#include "static_batch.h"
+#include "render_engine.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace RenderDoos
+  {
+
+  namespace
+    {
+    void transform_position(float* out, const float* in, const float4x4& m)
+      {
+      float4 p = transform(m, float4(in[0], in[1], in[2], 1.f));
+      out[0] = p[0];
+      out[1] = p[1];
+      out[2] = p[2];
+      }
+
+    void transform_normal(float* out, const float* in, const float4x4& normal_transform)
+      {
+      float4 n = matrix_vector_multiply(normal_transform, float4(in[0], in[1], in[2], 0.f));
+      n[3] = 0.f;
+      n = normalize(n);
+      out[0] = n[0];
+      out[1] = n[1];
+      out[2] = n[2];
+      }
+
+    float4x4 make_normal_transform(const float4x4& m)
+      {
+      return transpose(invert(m));
+      }
+    }
+
+  static_batch::static_batch() : vertex_declaration_type(0), vertex_size(0)
+    {
+    }
+
+  static_batch::~static_batch()
+    {
+    }
+
+  uint8_t* static_batch::_add_source(int32_t declaration_type, int32_t size, int32_t number_of_vertices, const uint32_t* indices, int32_t number_of_indices)
+    {
+    if (vertex_declaration_type == 0)
+      {
+      vertex_declaration_type = declaration_type;
+      vertex_size = size;
+      }
+    else if (vertex_declaration_type != declaration_type)
+      throw std::runtime_error("All sources of a static batch should have the same vertex type");
+    source src;
+    src.vertex_offset = (int32_t)(vertex_data.size() / vertex_size);
+    src.number_of_vertices = number_of_vertices;
+    src.index_offset = (int32_t)index_data.size();
+    src.number_of_indices = number_of_indices;
+    src.batch = -1;
+    src.first_index = 0;
+    src.visible = true;
+    sources.push_back(src);
+    index_data.insert(index_data.end(), indices, indices + number_of_indices);
+    vertex_data.resize(vertex_data.size() + (size_t)number_of_vertices * vertex_size);
+    return vertex_data.data() + (size_t)src.vertex_offset * vertex_size;
+    }
+
+  int32_t static_batch::add(const vertex_standard* vertices, int32_t number_of_vertices, const uint32_t* indices, int32_t number_of_indices, const float4x4& transform)
+    {
+    vertex_standard* out = (vertex_standard*)_add_source(VERTEX_STANDARD, sizeof(vertex_standard), number_of_vertices, indices, number_of_indices);
+    float4x4 normal_transform = make_normal_transform(transform);
+    for (int32_t i = 0; i < number_of_vertices; ++i)
+      {
+      out[i] = vertices[i];
+      transform_position(&out[i].x, &vertices[i].x, transform);
+      transform_normal(&out[i].nx, &vertices[i].nx, normal_transform);
+      }
+    return (int32_t)sources.size() - 1;
+    }
+
+  int32_t static_batch::add(const vertex_compact* vertices, int32_t number_of_vertices, const uint32_t* indices, int32_t number_of_indices, const float4x4& transform)
+    {
+    vertex_compact* out = (vertex_compact*)_add_source(VERTEX_COMPACT, sizeof(vertex_compact), number_of_vertices, indices, number_of_indices);
+    for (int32_t i = 0; i < number_of_vertices; ++i)
+      {
+      out[i] = vertices[i];
+      transform_position(&out[i].x, &vertices[i].x, transform);
+      }
+    return (int32_t)sources.size() - 1;
+    }
+
+  int32_t static_batch::add(const vertex_color* vertices, int32_t number_of_vertices, const uint32_t* indices, int32_t number_of_indices, const float4x4& transform)
+    {
+    vertex_color* out = (vertex_color*)_add_source(VERTEX_COLOR, sizeof(vertex_color), number_of_vertices, indices, number_of_indices);
+    float4x4 normal_transform = make_normal_transform(transform);
+    for (int32_t i = 0; i < number_of_vertices; ++i)
+      {
+      out[i] = vertices[i];
+      transform_position(&out[i].x, &vertices[i].x, transform);
+      transform_normal(&out[i].nx, &vertices[i].nx, normal_transform);
+      }
+    return (int32_t)sources.size() - 1;
+    }
+
+  void static_batch::build(render_engine* engine, int32_t max_vertices_per_batch, int32_t geometry_flags)
+    {
+    if (!batches.empty()) // the transformed vertices are released after the first build
+      return;
+    size_t first = 0;
+    while (first < sources.size())
+      {
+      // a source that exceeds the budget on its own gets a batch of its own
+      size_t last = first + 1;
+      int32_t number_of_vertices = sources[first].number_of_vertices;
+      int32_t number_of_indices = sources[first].number_of_indices;
+      while (last < sources.size() && number_of_vertices + sources[last].number_of_vertices <= max_vertices_per_batch)
+        {
+        number_of_vertices += sources[last].number_of_vertices;
+        number_of_indices += sources[last].number_of_indices;
+        ++last;
+        }
+      int32_t geometry = engine->add_geometry(vertex_declaration_type, INDEX_TYPE_AUTO, geometry_flags);
+      if (geometry < 0)
+        throw std::runtime_error("Out of geometry handles for the static batch");
+      float* vp;
+      uint32_t* ip;
+      engine->geometry_begin(geometry, number_of_vertices, number_of_indices, &vp, (void**)&ip);
+      memcpy(vp, vertex_data.data() + (size_t)sources[first].vertex_offset * vertex_size, (size_t)number_of_vertices * vertex_size);
+      int32_t first_index = 0;
+      for (size_t s = first; s < last; ++s)
+        {
+        source& src = sources[s];
+        uint32_t base_vertex = (uint32_t)(src.vertex_offset - sources[first].vertex_offset);
+        for (int32_t i = 0; i < src.number_of_indices; ++i)
+          ip[first_index + i] = index_data[src.index_offset + i] + base_vertex;
+        src.batch = (int32_t)batches.size();
+        src.first_index = first_index;
+        first_index += src.number_of_indices;
+        }
+      engine->geometry_end(geometry);
+      batches.push_back(geometry);
+      first = last;
+      }
+    // the gpu has the data now
+    vertex_data.clear();
+    vertex_data.shrink_to_fit();
+    index_data.clear();
+    index_data.shrink_to_fit();
+    }
+
+  void static_batch::destroy(render_engine* engine)
+    {
+    for (int32_t geometry : batches) // earlier frames may still draw them
+      engine->remove_deferred(RESOURCE_GEOMETRY, geometry);
+    batches.clear();
+    sources.clear();
+    vertex_data.clear();
+    index_data.clear();
+    vertex_declaration_type = 0;
+    }
+
+  void static_batch::set_visible(int32_t source, bool visible)
+    {
+    if (source >= 0 && source < (int32_t)sources.size())
+      sources[source].visible = visible;
+    }
+
+  bool static_batch::is_visible(int32_t source) const
+    {
+    return source >= 0 && source < (int32_t)sources.size() && sources[source].visible;
+    }
+
+  void static_batch::draw(render_engine* engine)
+    {
+    // adjacent visible sources of a batch form one index range
+    commands.clear();
+    for (const auto& src : sources)
+      {
+      if (!src.visible || src.batch < 0 || src.number_of_indices == 0)
+        continue;
+      if (!commands.empty() && commands.back().geometry == batches[src.batch] && commands.back().first_index + commands.back().index_count == src.first_index)
+        {
+        commands.back().index_count += src.number_of_indices;
+        continue;
+        }
+      draw_command command;
+      command.geometry = batches[src.batch];
+      command.first_index = src.first_index;
+      command.index_count = src.number_of_indices;
+      command.base_vertex = 0;
+      command.instance_count = 1;
+      command.base_instance = 0;
+      commands.push_back(command);
+      }
+    if (!commands.empty())
+      engine->geometry_draw_batch(commands.data(), (int32_t)commands.size());
+    }
+
+  }
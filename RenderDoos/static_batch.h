@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "float.h"
+#include "render_context.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+
+  // merges static geometries that share a material into pre-transformed combined vertex and index buffers, split in
+  // batches of at most max_vertices_per_batch vertices. Each source keeps its index range in its batch, so hiding a
+  // source only changes the draw commands.
+  class static_batch
+    {
+    public:
+      static_batch();
+      ~static_batch();
+
+      // the vertices are transformed to world space on add, all sources must have the same vertex type. Returns the source id.
+      int32_t add(const vertex_standard* vertices, int32_t number_of_vertices, const uint32_t* indices, int32_t number_of_indices, const float4x4& transform);
+      int32_t add(const vertex_compact* vertices, int32_t number_of_vertices, const uint32_t* indices, int32_t number_of_indices, const float4x4& transform);
+      int32_t add(const vertex_color* vertices, int32_t number_of_vertices, const uint32_t* indices, int32_t number_of_indices, const float4x4& transform);
+
+      // makes the batch geometries, with INDEX_TYPE_AUTO so that batches within 65536 vertices get 16-bit indices.
+      // Pass GEOMETRY_POOLED as geometry_flags to place all batches in one buffer, so that draw needs a single multi draw.
+      void build(render_engine* engine, int32_t max_vertices_per_batch = 65536, int32_t geometry_flags = 0);
+      void destroy(render_engine* engine); // removes the batch geometries and the sources
+
+      void set_visible(int32_t source, bool visible);
+      bool is_visible(int32_t source) const;
+
+      void draw(render_engine* engine); // draws the visible sources, bind the shared material first
+
+      int32_t get_number_of_batches() const { return (int32_t)batches.size(); }
+      int32_t get_geometry(int32_t batch) const { return batches[batch]; }
+
+    private:
+      struct source
+        {
+        int32_t vertex_offset;     // in vertices, in vertex_data before build
+        int32_t number_of_vertices;
+        int32_t index_offset;      // in index_data before build
+        int32_t number_of_indices;
+        int32_t batch;             // set by build
+        int32_t first_index;       // in the indices of the batch, set by build
+        bool visible;
+        };
+
+      uint8_t* _add_source(int32_t vertex_declaration_type, int32_t vertex_size, int32_t number_of_vertices, const uint32_t* indices, int32_t number_of_indices);
+
+    private:
+      int32_t vertex_declaration_type; // 0 until the first add
+      int32_t vertex_size;
+      std::vector<uint8_t> vertex_data;
+      std::vector<uint32_t> index_data;
+      std::vector<source> sources;
+      std::vector<int32_t> batches; // geometry handles
+      std::vector<draw_command> commands;
+    };
+
+  }
@@ -0,0 +1,100 @@
+#include "streaming_compute.h"
+#include "render_engine.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace RenderDoos
+  {
+
+  streaming_compute::streaming_compute() : program_handle(-1), number_of_elements_handle(-1), input_element_size(0), output_element_size(0),
+    elements_per_chunk(0), local_size(1)
+    {
+    }
+
+  streaming_compute::~streaming_compute()
+    {
+    }
+
+  void streaming_compute::init(render_engine* engine, int32_t program, int32_t input_size, int32_t output_size, int32_t chunk_size, int32_t group_size, int32_t number_of_slots)
+    {
+    destroy(engine);
+    program_handle = program;
+    input_element_size = input_size;
+    output_element_size = output_size;
+    local_size = std::max<int32_t>(group_size, 1);
+    elements_per_chunk = std::min<int32_t>(std::max<int32_t>(chunk_size, 1), 65535 * local_size); // one dispatch per chunk
+    number_of_elements_handle = engine->add_uniform("NumberOfElements", uniform_type::integer, 1);
+    number_of_slots = std::min<int32_t>(std::max<int32_t>(number_of_slots, 1), MAX_READBACKS);
+    for (int32_t i = 0; i < number_of_slots; ++i)
+      {
+      slot s;
+      s.input_buffer_handle = engine->add_buffer_object(nullptr, elements_per_chunk * input_element_size, COMPUTE_BUFFER);
+      s.output_buffer_handle = engine->add_buffer_object(nullptr, elements_per_chunk * output_element_size, COMPUTE_BUFFER);
+      if (s.input_buffer_handle < 0 || s.output_buffer_handle < 0)
+        throw std::runtime_error("Out of buffer objects for streaming compute");
+      s.readback = -1;
+      s.first_element = 0;
+      s.number_of_elements = 0;
+      slots.push_back(s);
+      }
+    output.resize((size_t)elements_per_chunk * output_element_size);
+    }
+
+  void streaming_compute::destroy(render_engine* engine)
+    {
+    for (auto& s : slots)
+      {
+      if (s.readback >= 0)
+        engine->finish_readback(s.readback, output.data());
+      engine->remove_deferred(RESOURCE_BUFFER_OBJECT, s.input_buffer_handle); // dispatches of earlier chunks may still use them
+      engine->remove_deferred(RESOURCE_BUFFER_OBJECT, s.output_buffer_handle);
+      }
+    slots.clear();
+    engine->remove_uniform(number_of_elements_handle);
+    number_of_elements_handle = -1;
+    program_handle = -1;
+    }
+
+  void streaming_compute::_finish(render_engine* engine, slot& s, const streaming_compute_callback& callback)
+    {
+    engine->finish_readback(s.readback, output.data());
+    s.readback = -1;
+    callback(s.first_element, s.number_of_elements, output.data());
+    }
+
+  void streaming_compute::run(render_engine* engine, const void* input, int64_t number_of_elements, const streaming_compute_callback& callback)
+    {
+    if (slots.empty())
+      return;
+    const uint8_t* p_input = (const uint8_t*)input;
+    size_t current = 0;
+    int64_t next = 0;
+    while (next < number_of_elements)
+      {
+      slot& s = slots[current];
+      if (s.readback >= 0) // the oldest chunk in flight, its buffers are free once it is read back
+        _finish(engine, s, callback);
+      s.first_element = next;
+      s.number_of_elements = (int32_t)std::min<int64_t>(number_of_elements - next, elements_per_chunk);
+      engine->update_buffer_object(s.input_buffer_handle, p_input + (size_t)next * input_element_size, s.number_of_elements * input_element_size);
+      engine->bind_program(program_handle);
+      engine->set_uniform(number_of_elements_handle, (void*)&s.number_of_elements);
+      engine->bind_uniform(program_handle, number_of_elements_handle);
+      engine->bind_buffer_object(s.input_buffer_handle, 0);
+      engine->bind_buffer_object(s.output_buffer_handle, 1);
+      engine->dispatch_compute((s.number_of_elements + local_size - 1) / local_size, 1, 1, local_size, 1, 1);
+      s.readback = engine->readback_buffer_object(s.output_buffer_handle, s.number_of_elements * output_element_size);
+      if (s.readback < 0)
+        throw std::runtime_error("Out of readback handles for streaming compute");
+      next += s.number_of_elements;
+      current = (current + 1) % slots.size();
+      }
+    for (size_t i = 0; i < slots.size(); ++i) // the chunks still in flight, oldest first
+      {
+      slot& s = slots[(current + i) % slots.size()];
+      if (s.readback >= 0)
+        _finish(engine, s, callback);
+      }
+    }
+
+  }
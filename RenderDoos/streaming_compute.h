@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+#include "render_context.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+
+  typedef std::function<void(int64_t first_element, int32_t number_of_elements, const void* output)> streaming_compute_callback;
+
+  // runs a compute kernel over an input that does not fit in gpu memory. The input is split in chunks, and each of the
+  // number_of_slots slots has its own input and output buffer, so the upload and dispatch of a chunk overlap with the
+  // work and readback of the chunks before it.
+  class streaming_compute
+    {
+    public:
+      streaming_compute();
+      ~streaming_compute();
+
+      // the kernel reads the elements of a chunk from channel 0 and writes output_element_size bytes per element to channel 1.
+      // It gets the number of elements of the chunk in the integer uniform NumberOfElements, its only uniform on metal.
+      void init(render_engine* engine, int32_t program_handle, int32_t input_element_size, int32_t output_element_size, int32_t elements_per_chunk, int32_t local_size = 64, int32_t number_of_slots = 3);
+      void destroy(render_engine* engine);
+
+      // call inside a renderpass with compute_shader set to true. The callback gets the output of the chunks in order.
+      void run(render_engine* engine, const void* input, int64_t number_of_elements, const streaming_compute_callback& callback);
+
+    private:
+      struct slot
+        {
+        int32_t input_buffer_handle;
+        int32_t output_buffer_handle;
+        int32_t readback;          // -1 if the slot holds no chunk
+        int64_t first_element;
+        int32_t number_of_elements;
+        };
+
+      void _finish(render_engine* engine, slot& s, const streaming_compute_callback& callback);
+
+    private:
+      int32_t program_handle;
+      int32_t number_of_elements_handle; // uniform
+      int32_t input_element_size, output_element_size;
+      int32_t elements_per_chunk, local_size;
+      std::vector<slot> slots;
+      std::vector<uint8_t> output;
+    };
+
+  }
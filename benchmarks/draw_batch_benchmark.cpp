@@ -0,0 +1,176 @@
+// cpu overhead of 50k draws, sent one by one and with geometry_draw_batch, which merges them into multi draws.
+// Runs headless on an EGL pbuffer, so it needs a desktop OpenGL 4.5 driver with EGL.
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "RenderDoos/render_engine.h"
+#include "RenderDoos/material.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace RenderDoos;
+
+namespace
+  {
+  const int32_t number_of_geometries = 500;
+  const int32_t draws_per_geometry = 100; // 50k draws in total
+  const int32_t number_of_frames = 20;
+
+  struct gl_context
+    {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+    };
+
+  bool create_context(gl_context& ctx)
+    {
+    ctx.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (ctx.display == EGL_NO_DISPLAY || !eglInitialize(ctx.display, nullptr, nullptr))
+      return false;
+    const EGLint config_attributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config;
+    EGLint number_of_configs = 0;
+    if (!eglChooseConfig(ctx.display, config_attributes, &config, 1, &number_of_configs) || number_of_configs == 0)
+      return false;
+    const EGLint surface_attributes[] = { EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE };
+    ctx.surface = eglCreatePbufferSurface(ctx.display, config, surface_attributes);
+    if (ctx.surface == EGL_NO_SURFACE || !eglBindAPI(EGL_OPENGL_API))
+      return false;
+    const EGLint context_attributes[] = { EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 5, EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+    ctx.context = eglCreateContext(ctx.display, config, EGL_NO_CONTEXT, context_attributes);
+    if (ctx.context == EGL_NO_CONTEXT || !eglMakeCurrent(ctx.display, ctx.surface, ctx.surface, ctx.context))
+      return false;
+    glewExperimental = GL_TRUE;
+    GLenum result = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if (result == GLEW_ERROR_NO_GLX_DISPLAY) // the gl entry points are loaded, only the glx ones are missing
+      result = GLEW_OK;
+#endif
+    return result == GLEW_OK;
+    }
+
+  void destroy_context(gl_context& ctx)
+    {
+    eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (ctx.context != EGL_NO_CONTEXT)
+      eglDestroyContext(ctx.display, ctx.context);
+    if (ctx.surface != EGL_NO_SURFACE)
+      eglDestroySurface(ctx.display, ctx.surface);
+    eglTerminate(ctx.display);
+    }
+
+  // a strip of draws_per_geometry quads, each quad is one draw
+  int32_t make_geometry(render_engine& engine, float y)
+    {
+    int32_t handle = engine.add_geometry(VERTEX_STANDARD, INDEX_TYPE_32, GEOMETRY_POOLED);
+    vertex_standard* vertices;
+    uint32_t* indices;
+    engine.geometry_begin(handle, draws_per_geometry * 4, draws_per_geometry * 6, (float**)&vertices, (void**)&indices);
+    for (int32_t q = 0; q < draws_per_geometry; ++q)
+      {
+      float x = -1.f + 2.f * q / draws_per_geometry;
+      float w = 1.f / draws_per_geometry;
+      for (int32_t c = 0; c < 4; ++c)
+        {
+        vertex_standard& v = vertices[q * 4 + c];
+        v.x = x + ((c & 1) ? w : 0.f);
+        v.y = y + ((c & 2) ? 0.001f : 0.f);
+        v.z = 0.5f;
+        v.nx = 0.f;
+        v.ny = 0.f;
+        v.nz = 1.f;
+        v.u = 0.f;
+        v.v = 0.f;
+        }
+      const uint32_t quad[6] = { 0, 1, 2, 2, 1, 3 };
+      for (int32_t i = 0; i < 6; ++i)
+        indices[q * 6 + i] = q * 4 + quad[i];
+      }
+    engine.geometry_end(handle);
+    return handle;
+    }
+
+  // average cpu time in milliseconds of sending the draws of a frame, and the draw calls the driver saw
+  double run(render_engine& engine, simple_material& mat, int32_t frame_buffer, const std::vector<draw_command>& commands, bool batched, uint64_t& draw_calls)
+    {
+    double total = 0.0;
+    for (int32_t frame = 0; frame < number_of_frames + 1; ++frame) // the first frame warms up the driver
+      {
+      engine.frame_begin(render_drawables());
+      renderpass_descriptor descr;
+      descr.frame_buffer_handle = frame_buffer;
+      descr.w = 256;
+      descr.h = 256;
+      engine.renderpass_begin(descr);
+      mat.bind(&engine);
+      auto start = std::chrono::steady_clock::now();
+      if (batched)
+        engine.geometry_draw_batch(commands.data(), (int32_t)commands.size());
+      else
+        {
+        for (const auto& command : commands)
+          engine.geometry_draw_batch(&command, 1);
+        }
+      auto stop = std::chrono::steady_clock::now();
+      engine.renderpass_end();
+      engine.frame_end(true);
+      if (frame > 0)
+        total += std::chrono::duration<double, std::milli>(stop - start).count();
+      }
+    draw_calls = engine.get_statistics().draw_calls;
+    return total / number_of_frames;
+    }
+  }
+
+int main()
+  {
+  gl_context ctx;
+  if (!create_context(ctx))
+    {
+    printf("Could not create an OpenGL 4.5 context\n");
+    destroy_context(ctx);
+    return 1;
+    }
+  render_engine engine;
+  engine.init(nullptr, nullptr, renderer_type::OPENGL);
+  simple_material mat;
+  mat.compile(&engine);
+  int32_t frame_buffer = engine.add_frame_buffer(256, 256, true);
+
+  std::vector<draw_command> commands;
+  commands.reserve(number_of_geometries * draws_per_geometry);
+  for (int32_t g = 0; g < number_of_geometries; ++g)
+    {
+    int32_t geometry = make_geometry(engine, -1.f + 2.f * g / number_of_geometries);
+    for (int32_t q = 0; q < draws_per_geometry; ++q)
+      {
+      draw_command command;
+      command.geometry = geometry;
+      command.first_index = q * 6;
+      command.index_count = 6;
+      command.base_vertex = 0;
+      command.instance_count = 1;
+      command.base_instance = 0;
+      commands.push_back(command);
+      }
+    }
+
+  uint64_t single_calls = 0, batched_calls = 0;
+  double single = run(engine, mat, frame_buffer, commands, false, single_calls);
+  double batched = run(engine, mat, frame_buffer, commands, true, batched_calls);
+  printf("%d draws, average over %d frames\n", (int)commands.size(), number_of_frames);
+  printf("one by one: %8.3f ms, %llu draw calls\n", single, (unsigned long long)single_calls);
+  printf("batched:    %8.3f ms, %llu draw calls\n", batched, (unsigned long long)batched_calls);
+  printf("speedup:    %8.2fx\n", batched > 0.0 ? single / batched : 0.0);
+
+  mat.destroy(&engine);
+  engine.destroy();
+  destroy_context(ctx);
+  return 0;
+  }